@@ -0,0 +1,215 @@
+#include "devices/apic.h"
+#include <debug.h>
+#include <stddef.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+/* Local and I/O Advanced Programmable Interrupt Controllers.
+   Refer to [IA32-v3a] chapter 8 "Advanced Programmable Interrupt
+   Controller (APIC)" and [IOAPIC] for details.
+
+   Each CPU has a local APIC, through which it sends and receives
+   interprocessor interrupts (IPIs).  We leave device interrupts
+   to the 8259A PICs (see interrupt.c): the BSP's local APIC
+   passes them through in "virtual wire" mode, and every I/O
+   APIC input is masked so that none is delivered twice. */
+
+/* Local APIC registers, as indexes into an array of 32-bit
+   words.  Each register is 16-byte aligned. */
+#define LAPIC_ID        (0x020 / 4)     /* ID. */
+#define LAPIC_VER       (0x030 / 4)     /* Version. */
+#define LAPIC_TPR       (0x080 / 4)     /* Task priority. */
+#define LAPIC_EOI       (0x0b0 / 4)     /* End of interrupt. */
+#define LAPIC_SVR       (0x0f0 / 4)     /* Spurious interrupt vector. */
+#define LAPIC_ESR       (0x280 / 4)     /* Error status. */
+#define LAPIC_ICRLO     (0x300 / 4)     /* Interrupt command, bits 0-31. */
+#define LAPIC_ICRHI     (0x310 / 4)     /* Interrupt command, bits 32-63. */
+#define LAPIC_TIMER     (0x320 / 4)     /* LVT timer. */
+#define LAPIC_PCINT     (0x340 / 4)     /* LVT performance counter. */
+#define LAPIC_LINT0     (0x350 / 4)     /* LVT local interrupt 0. */
+#define LAPIC_LINT1     (0x360 / 4)     /* LVT local interrupt 1. */
+#define LAPIC_ERROR     (0x370 / 4)     /* LVT error. */
+
+/* Local APIC register bits. */
+#define SVR_ENABLE      0x00000100      /* APIC software enable. */
+#define LVT_MASKED      0x00010000      /* Interrupt masked. */
+#define LVT_NMI         0x00000400      /* NMI delivery. */
+#define LVT_EXTINT      0x00000700      /* ExtINT delivery (from a PIC). */
+#define ICR_FIXED       0x00000000      /* Fixed delivery. */
+#define ICR_INIT        0x00000500      /* INIT delivery. */
+#define ICR_STARTUP     0x00000600      /* Start-up delivery. */
+#define ICR_PENDING     0x00001000      /* Delivery in progress. */
+#define ICR_ASSERT      0x00004000      /* Level asserted. */
+#define ICR_LEVEL       0x00008000      /* Level triggered. */
+
+/* Vector for spurious local APIC interrupts.  Its low 4 bits
+   must be set on older APICs. */
+#define LAPIC_SPURIOUS  0xff
+
+/* I/O APIC registers, accessed indirectly through IOREGSEL and
+   IOWIN. */
+#define IOAPIC_IOREGSEL (0x00 / 4)      /* Register select. */
+#define IOAPIC_IOWIN    (0x10 / 4)      /* Register window. */
+#define IOAPIC_VER      0x01            /* Version. */
+#define IOAPIC_REDTBL   0x10            /* Redirection table base. */
+
+/* Memory-mapped registers, or null if not (yet) mapped. */
+static volatile uint32_t *lapic;
+static volatile uint32_t *ioapic;
+
+static volatile uint32_t *apic_map (uintptr_t paddr);
+static void lapic_write (int reg, uint32_t value);
+static void lapic_icr (uint32_t hi, uint32_t lo);
+
+/* Maps the local APICs' registers at physical address
+   LAPIC_PADDR and the I/O APIC's at IOAPIC_PADDR (if nonzero)
+   into the kernel's address space, and masks every I/O APIC
+   input.  Must be called once, by the BSP, before any process's
+   page directory is created. */
+void
+apic_init (uintptr_t lapic_paddr, uintptr_t ioapic_paddr) 
+{
+  lapic = apic_map (lapic_paddr);
+
+  if (ioapic_paddr != 0)
+    {
+      int max_entry, i;
+
+      ioapic = apic_map (ioapic_paddr);
+      ioapic[IOAPIC_IOREGSEL] = IOAPIC_VER;
+      max_entry = (ioapic[IOAPIC_IOWIN] >> 16) & 0xff;
+      for (i = 0; i <= max_entry; i++) 
+        {
+          ioapic[IOAPIC_IOREGSEL] = IOAPIC_REDTBL + 2 * i;
+          ioapic[IOAPIC_IOWIN] = LVT_MASKED | (0x20 + i);
+          ioapic[IOAPIC_IOREGSEL] = IOAPIC_REDTBL + 2 * i + 1;
+          ioapic[IOAPIC_IOWIN] = 0;
+        }
+    }
+}
+
+/* Initializes the running CPU's local APIC.  The BSP's (if BSP
+   is true) passes 8259A interrupts through; the others ignore
+   them. */
+void
+lapic_init (bool bsp) 
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS);
+  lapic_write (LAPIC_TIMER, LVT_MASKED);
+  lapic_write (LAPIC_LINT0, bsp ? LVT_EXTINT : LVT_MASKED);
+  lapic_write (LAPIC_LINT1, bsp ? LVT_NMI : LVT_MASKED);
+  if (((lapic[LAPIC_VER] >> 16) & 0xff) >= 4)
+    lapic_write (LAPIC_PCINT, LVT_MASKED);
+  lapic_write (LAPIC_ERROR, LVT_MASKED);
+
+  /* Clear errors (which takes back-to-back writes) and any
+     interrupt left in service, then accept all interrupts. */
+  lapic_write (LAPIC_ESR, 0);
+  lapic_write (LAPIC_ESR, 0);
+  lapic_write (LAPIC_EOI, 0);
+  lapic_write (LAPIC_TPR, 0);
+}
+
+/* Returns the running CPU's local APIC ID. */
+unsigned
+lapic_id (void) 
+{
+  ASSERT (lapic != NULL);
+  return lapic[LAPIC_ID] >> 24;
+}
+
+/* Acknowledges an interrupt delivered by the local APIC. */
+void
+lapic_eoi (void) 
+{
+  lapic_write (LAPIC_EOI, 0);
+}
+
+/* Sends interrupt VEC to the CPU with local APIC ID APIC_ID. */
+void
+lapic_send_ipi (unsigned apic_id, uint8_t vec) 
+{
+  lapic_icr (apic_id << 24, ICR_FIXED | ICR_ASSERT | vec);
+}
+
+/* Starts the CPU with local APIC ID APIC_ID running real-mode
+   code at PADDR, which must be page-aligned and below 1 MB,
+   using the INIT-SIPI-SIPI sequence from [MP] appendix B.4. */
+void
+lapic_start_ap (unsigned apic_id, uintptr_t paddr) 
+{
+  uint16_t *warm_reset_vector = ptov (0x467);
+  int i;
+
+  ASSERT (paddr % PGSIZE == 0 && paddr < 0x100000);
+
+  /* Older CPUs start at the warm reset vector after INIT, if
+     the CMOS shutdown code says so. */
+  outb (0x70, 0x0f);
+  outb (0x71, 0x0a);
+  warm_reset_vector[0] = 0;
+  warm_reset_vector[1] = paddr >> 4;
+
+  lapic_icr (apic_id << 24, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+  timer_udelay (200);
+  lapic_icr (apic_id << 24, ICR_INIT | ICR_LEVEL);
+  timer_mdelay (10);
+
+  for (i = 0; i < 2; i++) 
+    {
+      lapic_icr (apic_id << 24, ICR_STARTUP | (paddr >> 12));
+      timer_udelay (200);
+    }
+}
+
+/* Maps the page of APIC registers at physical address PADDR at
+   the same kernel virtual address, uncached, and returns it.
+   APIC registers live near the top of the physical address
+   space, far beyond the RAM that is mapped at PHYS_BASE. */
+static volatile uint32_t *
+apic_map (uintptr_t paddr) 
+{
+  uint32_t *pde, *pt;
+  void *vaddr = (void *) paddr;
+
+  ASSERT (pg_ofs (vaddr) == 0);
+  ASSERT (vaddr >= ptov (init_ram_pages * PGSIZE));
+
+  pde = init_page_dir + pd_no (vaddr);
+  if (*pde == 0)
+    {
+      pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+      *pde = pde_create (pt);
+    }
+  else
+    pt = pde_get_pt (*pde);
+  pt[pt_no (vaddr)] = paddr | PTE_P | PTE_W | PTE_PWT | PTE_PCD;
+  return vaddr;
+}
+
+/* Writes VALUE to local APIC register REG, then waits for the
+   write to take effect by reading back the ID register. */
+static void
+lapic_write (int reg, uint32_t value) 
+{
+  lapic[reg] = value;
+  (void) lapic[LAPIC_ID];
+}
+
+/* Sends the interprocessor interrupt described by HI and LO,
+   the high and low words of the interrupt command register,
+   and waits for it to be delivered. */
+static void
+lapic_icr (uint32_t hi, uint32_t lo) 
+{
+  lapic_write (LAPIC_ICRHI, hi);
+  lapic_write (LAPIC_ICRLO, lo);
+  while (lapic[LAPIC_ICRLO] & ICR_PENDING)
+    asm volatile ("pause" : : : "memory");
+}
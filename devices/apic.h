@@ -0,0 +1,14 @@
+#ifndef DEVICES_APIC_H
+#define DEVICES_APIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void apic_init (uintptr_t lapic_paddr, uintptr_t ioapic_paddr);
+void lapic_init (bool bsp);
+unsigned lapic_id (void);
+void lapic_eoi (void);
+void lapic_send_ipi (unsigned apic_id, uint8_t vec);
+void lapic_start_ap (unsigned apic_id, uintptr_t paddr);
+
+#endif /* devices/apic.h */
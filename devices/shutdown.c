@@ -5,7 +5,14 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/profile.h"
+#include "threads/slab.h"
+#include "threads/softirq.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
@@ -13,6 +20,9 @@
 #include "devices/block.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/swap.h"
+#endif
 
 /* Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -94,6 +104,8 @@ shutdown_power_off (void)
   filesys_done ();
 #endif
 
+  trace_dump ();
+  profile_dump ();
   print_stats ();
 
   printf ("Powering off...\n");
@@ -120,8 +132,16 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  softirq_print_stats ();
+  kmem_cache_print_stats ();
+  palloc_print_stats ();
+  malloc_print_stats ();
+  lock_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+#endif
+#ifdef VM
+  swap_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
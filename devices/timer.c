@@ -5,8 +5,12 @@
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
+#include "threads/smp.h"
+#include "threads/softirq.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
   
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -25,6 +29,7 @@ static int64_t ticks;
 static unsigned loops_per_tick;
 
 static intr_handler_func timer_interrupt;
+static softirq_func timer_softirq;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -37,6 +42,7 @@ timer_init (void)
 {
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  softirq_register (SOFTIRQ_TIMER, timer_softirq, "timer");
 }
 
 /* Calibrates loops_per_tick, used to implement brief delays. */
@@ -183,13 +189,26 @@ timer_print_stats (void)
 
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
   ticks++;
-  thread_tick ();
+  profile_sample (args);
+  thread_tick (args);
+  smp_timer_tick ();
+  workqueue_tick (ticks);
+
+  /* Leave waking sleepers for later. */
+  if (!list_empty (&waiting_list))
+    softirq_raise (SOFTIRQ_TIMER);
+}
 
+/* Timer softirq: wakes up threads whose timer_sleep() is over. */
+static void
+timer_softirq (void)
+{
   struct list_elem *e;
   struct list_elem *temp;
+  enum intr_level old_level = intr_disable ();
 
   for(e = list_begin(&waiting_list); e != list_end(&waiting_list); e = list_next(e)){
     struct thread *t = list_entry(e, struct thread, wait_elem);
@@ -203,6 +222,7 @@ timer_interrupt (struct intr_frame *args UNUSED)
     }
 
   }
+  intr_set_level (old_level);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -92,10 +92,8 @@ acquire_console (void)
     {
       if (lock_held_by_current_thread (&console_lock)) 
         console_lock_depth++; 
-      else{
-        thread_current()->acquired_by_console++;
+      else
         lock_acquire (&console_lock); 
-       } 
     }
 }
 
@@ -182,3 +182,46 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+futex_wait (int *addr, int expected) 
+{
+  return syscall2 (SYS_FUTEX_WAIT, addr, expected);
+}
+
+int
+futex_wake (int *addr, int cnt) 
+{
+  return syscall2 (SYS_FUTEX_WAKE, addr, cnt);
+}
+
+/* Entry point of every thread started by thread_create().  The
+   kernel starts us with FUNC and AUX as our arguments and a null
+   return address, so we must never return. */
+static void thread_entry (void (*func) (void *aux), void *aux) NO_RETURN;
+
+static void
+thread_entry (void (*func) (void *aux), void *aux) 
+{
+  func (aux);
+  thread_exit (0);
+}
+
+tid_t
+thread_create (void (*func) (void *aux), void *aux) 
+{
+  return syscall3 (SYS_THREAD_CREATE, thread_entry, func, aux);
+}
+
+int
+thread_join (tid_t tid) 
+{
+  return syscall1 (SYS_THREAD_JOIN, tid);
+}
+
+void
+thread_exit (int status) 
+{
+  syscall1 (SYS_THREAD_EXIT, status);
+  NOT_REACHED ();
+}
@@ -8,6 +8,10 @@
 typedef int pid_t;
 #define PID_ERROR ((pid_t) -1)
 
+/* Thread identifier. */
+typedef int tid_t;
+#define TID_ERROR ((tid_t) -1)
+
 /* Map region identifier. */
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
@@ -45,4 +49,13 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Synchronization. */
+int futex_wait (int *addr, int expected);
+int futex_wake (int *addr, int cnt);
+
+/* User threads. */
+tid_t thread_create (void (*func) (void *aux), void *aux);
+int thread_join (tid_t);
+void thread_exit (int status) NO_RETURN;
+
 #endif /* lib/user/syscall.h */
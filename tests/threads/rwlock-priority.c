@@ -0,0 +1,60 @@
+/* Tests that a reader-writer lock is handed to the
+   highest-priority waiter when it is released: a waiting writer
+   that outranks the waiting readers gets the lock first, and
+   then all of the waiting readers are admitted together. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static thread_func reader_thread;
+static thread_func writer_thread;
+static struct rwlock rwlock;
+
+void
+test_rwlock_priority (void) 
+{
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  /* Make sure our priority is the default. */
+  ASSERT (thread_get_priority () == PRI_DEFAULT);
+
+  rwlock_init (&rwlock, false);
+  rwlock_acquire_write (&rwlock);
+
+  for (i = 0; i < 3; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "reader %d", i);
+      thread_create (name, PRI_DEFAULT + 1, reader_thread, (void *) i);
+    }
+  thread_create ("writer", PRI_DEFAULT + 2, writer_thread, NULL);
+
+  msg ("Main releasing write lock.");
+  rwlock_release_write (&rwlock);
+  msg ("Main done.");
+}
+
+static void
+reader_thread (void *aux) 
+{
+  int id = (int) aux;
+
+  rwlock_acquire_read (&rwlock);
+  msg ("Reader %d got lock.", id);
+  rwlock_release_read (&rwlock);
+}
+
+static void
+writer_thread (void *aux UNUSED) 
+{
+  rwlock_acquire_write (&rwlock);
+  msg ("Writer got lock.");
+  rwlock_release_write (&rwlock);
+  msg ("Writer done.");
+}
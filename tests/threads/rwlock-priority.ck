@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-priority) begin
+(rwlock-priority) Main releasing write lock.
+(rwlock-priority) Writer got lock.
+(rwlock-priority) Writer done.
+(rwlock-priority) Reader 0 got lock.
+(rwlock-priority) Reader 1 got lock.
+(rwlock-priority) Reader 2 got lock.
+(rwlock-priority) Main done.
+(rwlock-priority) end
+EOF
+pass;
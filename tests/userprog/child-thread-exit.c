@@ -0,0 +1,42 @@
+/* Child process run by thread-exit-blocked.
+   Blocks its main thread in thread_join on a thread that sleeps
+   forever, while a third thread calls exit.  The process must
+   still exit with the third thread's status, and the main thread
+   must never get back to user mode. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "child-thread-exit";
+
+static int forever;
+static int asleep;
+
+static void
+sleeper (void *aux UNUSED) 
+{
+  asleep = 1;
+  futex_wait (&forever, 0);
+  fail ("sleeper woke up in user mode");
+}
+
+static void
+exiter (void *aux UNUSED) 
+{
+  while (!*(volatile int *) &asleep)
+    continue;
+  exit (57);
+}
+
+int
+main (void) 
+{
+  tid_t tid;
+
+  msg ("run");
+  tid = thread_create (sleeper, NULL);
+  if (tid == TID_ERROR || thread_create (exiter, NULL) == TID_ERROR)
+    fail ("thread_create");
+  thread_join (tid);
+  fail ("main thread returned from thread_join");
+}
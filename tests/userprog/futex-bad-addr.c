@@ -0,0 +1,25 @@
+/* Passes futex_wait and futex_wake addresses that are null,
+   unmapped, in kernel memory or misaligned.  Each call must fail
+   with -1; none may kill the process. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int word;
+
+void
+test_main (void) 
+{
+  int *misaligned = (int *) ((char *) &word + 1);
+
+  CHECK (futex_wait (NULL, 0) == -1, "futex_wait (NULL)");
+  CHECK (futex_wake (NULL, 1) == -1, "futex_wake (NULL)");
+  CHECK (futex_wait ((int *) 0x20101234, 0) == -1, "futex_wait (unmapped)");
+  CHECK (futex_wake ((int *) 0x20101234, 1) == -1, "futex_wake (unmapped)");
+  CHECK (futex_wait ((int *) 0xc0100000, 0) == -1, "futex_wait (kernel)");
+  CHECK (futex_wake ((int *) 0xc0100000, 1) == -1, "futex_wake (kernel)");
+  CHECK (futex_wait (misaligned, *misaligned) == -1,
+         "futex_wait (misaligned)");
+  CHECK (futex_wake (misaligned, 1) == -1, "futex_wake (misaligned)");
+}
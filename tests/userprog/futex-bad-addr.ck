@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-bad-addr) begin
+(futex-bad-addr) futex_wait (NULL)
+(futex-bad-addr) futex_wake (NULL)
+(futex-bad-addr) futex_wait (unmapped)
+(futex-bad-addr) futex_wake (unmapped)
+(futex-bad-addr) futex_wait (kernel)
+(futex-bad-addr) futex_wake (kernel)
+(futex-bad-addr) futex_wait (misaligned)
+(futex-bad-addr) futex_wake (misaligned)
+(futex-bad-addr) end
+futex-bad-addr: exit(0)
+EOF
+pass;
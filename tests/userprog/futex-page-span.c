@@ -0,0 +1,45 @@
+/* Uses futex words on either side of a page boundary, which must
+   have separate wait queues, and one that straddles the boundary,
+   which is misaligned and must be refused. */
+
+#include <syscall.h>
+#include "tests/userprog/boundary.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int asleep;
+
+static void
+waiter (void *word) 
+{
+  asleep = 1;
+  futex_wait (word, 0);
+}
+
+void
+test_main (void) 
+{
+  char *boundary = get_boundary_area ();
+  int *below = (int *) (boundary - sizeof (int));
+  int *above = (int *) boundary;
+  int *straddle = (int *) (boundary - sizeof (int) / 2);
+  tid_t tid;
+
+  *below = *above = 0;
+  CHECK ((tid = thread_create (waiter, above)) != TID_ERROR,
+         "thread_create");
+  while (!*(volatile int *) &asleep)
+    continue;
+
+  /* Waking the word on the other page must not find the sleeper,
+     however long it takes to fall asleep. */
+  CHECK (futex_wake (below, 1) == 0, "futex_wake on the page below");
+  while (futex_wake (above, 1) == 0)
+    continue;
+  msg ("futex_wake on the page above");
+  CHECK (thread_join (tid) == 0, "thread_join");
+
+  CHECK (futex_wait (straddle, *straddle) == -1,
+         "futex_wait across the boundary");
+  CHECK (futex_wake (straddle, 1) == -1, "futex_wake across the boundary");
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-page-span) begin
+(futex-page-span) thread_create
+(futex-page-span) futex_wake on the page below
+(futex-page-span) futex_wake on the page above
+(futex-page-span) thread_join
+(futex-page-span) futex_wait across the boundary
+(futex-page-span) futex_wake across the boundary
+(futex-page-span) end
+futex-page-span: exit(0)
+EOF
+pass;
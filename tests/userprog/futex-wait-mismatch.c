@@ -0,0 +1,15 @@
+/* Waits on a futex word that does not hold the expected value,
+   which must return -1 at once rather than sleep. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int word = 1;
+
+void
+test_main (void) 
+{
+  CHECK (futex_wait (&word, 0) == -1, "futex_wait on a mismatched word");
+  CHECK (futex_wait (&word, 2) == -1, "futex_wait on a mismatched word");
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-wait-mismatch) begin
+(futex-wait-mismatch) futex_wait on a mismatched word
+(futex-wait-mismatch) futex_wait on a mismatched word
+(futex-wait-mismatch) end
+futex-wait-mismatch: exit(0)
+EOF
+pass;
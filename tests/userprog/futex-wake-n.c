@@ -0,0 +1,52 @@
+/* Puts several threads to sleep on one futex word and wakes them
+   a few at a time.  No call may wake more threads than asked
+   for, every sleeper must be woken exactly once, and once they
+   are all gone there is nobody left to wake. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define WAITERS 4
+#define WAKE_CNT 2
+
+static int word;
+static int asleep;
+static int woken;
+
+static void
+waiter (void *aux UNUSED) 
+{
+  __sync_fetch_and_add (&asleep, 1);
+  if (futex_wait (&word, 0) == 0)
+    __sync_fetch_and_add (&woken, 1);
+}
+
+void
+test_main (void) 
+{
+  tid_t tids[WAITERS];
+  int total, i;
+
+  for (i = 0; i < WAITERS; i++)
+    CHECK ((tids[i] = thread_create (waiter, NULL)) != TID_ERROR,
+           "thread_create");
+  while (*(volatile int *) &asleep < WAITERS)
+    continue;
+
+  /* A waiter that has counted itself may not be asleep yet, in
+     which case a call wakes fewer than asked for; just go on. */
+  for (total = 0; total < WAITERS; ) 
+    {
+      int n = futex_wake (&word, WAKE_CNT);
+      if (n < 0 || n > WAKE_CNT)
+        fail ("futex_wake (%d) woke %d threads", WAKE_CNT, n);
+      total += n;
+    }
+  msg ("woke %d threads, at most %d at a time", total, WAKE_CNT);
+
+  for (i = 0; i < WAITERS; i++)
+    CHECK (thread_join (tids[i]) == 0, "thread_join");
+  CHECK (woken == WAITERS, "%d threads returned from futex_wait", woken);
+  CHECK (futex_wake (&word, WAKE_CNT) == 0, "futex_wake with no waiters left");
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-wake-n) begin
+(futex-wake-n) thread_create
+(futex-wake-n) thread_create
+(futex-wake-n) thread_create
+(futex-wake-n) thread_create
+(futex-wake-n) woke 4 threads, at most 2 at a time
+(futex-wake-n) thread_join
+(futex-wake-n) thread_join
+(futex-wake-n) thread_join
+(futex-wake-n) thread_join
+(futex-wake-n) 4 threads returned from futex_wait
+(futex-wake-n) futex_wake with no waiters left
+(futex-wake-n) end
+futex-wake-n: exit(0)
+EOF
+pass;
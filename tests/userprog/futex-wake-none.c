@@ -0,0 +1,15 @@
+/* Wakes a futex word that no thread is sleeping on, which must
+   wake nobody and report it. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int word;
+
+void
+test_main (void) 
+{
+  CHECK (futex_wake (&word, 1) == 0, "futex_wake with no waiters");
+  CHECK (futex_wake (&word, 10) == 0, "futex_wake with no waiters");
+}
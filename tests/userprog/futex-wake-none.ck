@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-wake-none) begin
+(futex-wake-none) futex_wake with no waiters
+(futex-wake-none) futex_wake with no waiters
+(futex-wake-none) end
+futex-wake-none: exit(0)
+EOF
+pass;
@@ -0,0 +1,14 @@
+/* Runs a child process whose non-main thread calls exit while
+   the main thread is blocked in the kernel.  wait must return
+   the status passed to exit, and only after the child's exit
+   message shows that it is gone. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  msg ("wait(exec()) = %d", wait (exec ("child-thread-exit")));
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-exit-blocked) begin
+(child-thread-exit) run
+child-thread-exit: exit(57)
+(thread-exit-blocked) wait(exec()) = 57
+(thread-exit-blocked) end
+thread-exit-blocked: exit(0)
+EOF
+pass;
@@ -0,0 +1,52 @@
+/* Has several threads open and close the same file many times at
+   once.  Every open must succeed with a descriptor no other open
+   has returned, and every close of one must succeed. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define ROUNDS 4
+#define OPENS 8
+
+static int fds[THREAD_CNT][ROUNDS * OPENS];
+
+static void
+opener (void *fds_) 
+{
+  int *fds = fds_;
+  int round, i;
+
+  for (round = 0; round < ROUNDS; round++) 
+    {
+      int *these = fds + round * OPENS;
+
+      for (i = 0; i < OPENS; i++)
+        if ((these[i] = open ("sample.txt")) < 2)
+          fail ("open returned %d", these[i]);
+      for (i = 0; i < OPENS; i++)
+        close (these[i]);
+    }
+}
+
+void
+test_main (void) 
+{
+  tid_t tids[THREAD_CNT];
+  int *all = &fds[0][0];
+  int cnt = THREAD_CNT * ROUNDS * OPENS;
+  int i, j;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK ((tids[i] = thread_create (opener, fds[i])) != TID_ERROR,
+           "thread_create");
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK (thread_join (tids[i]) == 0, "thread_join");
+
+  for (i = 0; i < cnt; i++)
+    for (j = i + 1; j < cnt; j++)
+      if (all[i] == all[j])
+        fail ("descriptor %d returned twice", all[i]);
+  msg ("%d distinct descriptors", cnt);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-fd-race) begin
+(thread-fd-race) thread_create
+(thread-fd-race) thread_create
+(thread-fd-race) thread_create
+(thread-fd-race) thread_create
+(thread-fd-race) thread_join
+(thread-fd-race) thread_join
+(thread-fd-race) thread_join
+(thread-fd-race) thread_join
+(thread-fd-race) 128 distinct descriptors
+(thread-fd-race) end
+thread-fd-race: exit(0)
+EOF
+pass;
@@ -0,0 +1,24 @@
+/* Joins the same thread twice.  The first join must return its
+   status and the second -1, whether the thread has already exited
+   by then or not. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static void
+child_thread (void *aux UNUSED) 
+{
+  thread_exit (7);
+}
+
+void
+test_main (void) 
+{
+  tid_t tid;
+
+  CHECK ((tid = thread_create (child_thread, NULL)) != TID_ERROR,
+         "thread_create");
+  CHECK (thread_join (tid) == 7, "first thread_join");
+  CHECK (thread_join (tid) == -1, "second thread_join");
+}
@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-join-twice) begin
+(thread-join-twice) thread_create
+(thread-join-twice) first thread_join
+(thread-join-twice) second thread_join
+(thread-join-twice) end
+thread-join-twice: exit(0)
+EOF
+pass;
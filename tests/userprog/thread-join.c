@@ -0,0 +1,52 @@
+/* Checks what thread_join returns: the status a thread passed to
+   thread_exit, 0 for a thread that returned from its function,
+   and -1 for a tid that is not a thread of this process or is the
+   caller's own. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static void
+exiting_thread (void *aux UNUSED) 
+{
+  thread_exit (42);
+}
+
+static void
+returning_thread (void *aux UNUSED) 
+{
+}
+
+static void
+self_joining_thread (void *tid_) 
+{
+  int *tid = tid_;
+
+  /* Our creator stores our tid before it joins us. */
+  while (*(volatile int *) tid == TID_ERROR)
+    continue;
+  thread_exit (thread_join (*tid));
+}
+
+void
+test_main (void) 
+{
+  tid_t tid;
+  int self = TID_ERROR;
+
+  CHECK ((tid = thread_create (exiting_thread, NULL)) != TID_ERROR,
+         "thread_create");
+  CHECK (thread_join (tid) == 42, "thread_join of thread_exit(42)");
+
+  CHECK ((tid = thread_create (returning_thread, NULL)) != TID_ERROR,
+         "thread_create");
+  CHECK (thread_join (tid) == 0, "thread_join of a returning thread");
+
+  CHECK ((tid = thread_create (self_joining_thread, &self)) != TID_ERROR,
+         "thread_create");
+  self = tid;
+  CHECK (thread_join (tid) == -1, "thread_join of itself");
+
+  CHECK (thread_join (12345) == -1, "thread_join of a bogus tid");
+}
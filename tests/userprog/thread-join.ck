@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-join) begin
+(thread-join) thread_create
+(thread-join) thread_join of thread_exit(42)
+(thread-join) thread_create
+(thread-join) thread_join of a returning thread
+(thread-join) thread_create
+(thread-join) thread_join of itself
+(thread-join) thread_join of a bogus tid
+(thread-join) end
+thread-join: exit(0)
+EOF
+pass;
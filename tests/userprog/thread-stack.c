@@ -0,0 +1,40 @@
+/* Runs a thread that recurses several pages deep on its own
+   stack, which must grow to hold it, and checks the result. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define DEPTH 24
+
+/* Uses about 512 bytes of stack per level. */
+static int
+recurse (int depth) 
+{
+  volatile int frame[128];
+
+  frame[0] = depth;
+  frame[127] = depth;
+  if (depth == 0)
+    return 0;
+  return recurse (depth - 1) + frame[0] + frame[127] - depth;
+}
+
+static void
+deep_thread (void *result_) 
+{
+  int *result = result_;
+  *result = recurse (DEPTH);
+}
+
+void
+test_main (void) 
+{
+  int result = -1;
+  tid_t tid;
+
+  CHECK ((tid = thread_create (deep_thread, &result)) != TID_ERROR,
+         "thread_create");
+  CHECK (thread_join (tid) == 0, "thread_join");
+  CHECK (result == DEPTH * (DEPTH + 1) / 2, "result is %d", result);
+}
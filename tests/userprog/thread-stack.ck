@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-stack) begin
+(thread-stack) thread_create
+(thread-stack) thread_join
+(thread-stack) result is 300
+(thread-stack) end
+thread-stack: exit(0)
+EOF
+pass;
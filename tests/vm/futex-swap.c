@@ -0,0 +1,48 @@
+/* Sleeps on a futex word while the rest of 2 MB of memory is
+   written, forcing the word's page out if nothing keeps it in,
+   and checks that the wake still finds the sleeper.  Then lets
+   the word's page go to swap and checks that waking it brings
+   the page back rather than fail. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE] __attribute__ ((aligned (4096)));
+static int asleep;
+
+static void
+waiter (void *word) 
+{
+  asleep = 1;
+  if (futex_wait (word, 0) != 0)
+    fail ("futex_wait returned without a wake");
+}
+
+void
+test_main (void) 
+{
+  int *word = (int *) buf;
+  tid_t tid;
+
+  CHECK ((tid = thread_create (waiter, word)) != TID_ERROR, "thread_create");
+  while (!*(volatile int *) &asleep)
+    continue;
+
+  msg ("write other pages");
+  memset (buf + 4096, 0x5a, SIZE - 4096);
+
+  *word = 1;
+  while (futex_wake (word, 1) == 0)
+    continue;
+  msg ("futex_wake found the sleeper");
+  CHECK (thread_join (tid) == 0, "thread_join");
+
+  msg ("write other pages");
+  memset (buf + 4096, 0xa5, SIZE - 4096);
+  CHECK (futex_wake (word, 1) == 0, "futex_wake on a swapped-out word");
+  CHECK (futex_wait (word, 0) == -1, "futex_wait on a changed word");
+}
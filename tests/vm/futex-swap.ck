@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-swap) begin
+(futex-swap) thread_create
+(futex-swap) write other pages
+(futex-swap) futex_wake found the sleeper
+(futex-swap) thread_join
+(futex-swap) write other pages
+(futex-swap) futex_wake on a swapped-out word
+(futex-swap) futex_wait on a changed word
+(futex-swap) end
+futex-swap: exit(0)
+EOF
+pass;
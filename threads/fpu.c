@@ -0,0 +1,205 @@
+#include "threads/fpu.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/smp.h"
+#include "threads/thread.h"
+
+/* CR0 bits. */
+#define CR0_MP 0x00000002       /* Monitor coprocessor. */
+#define CR0_EM 0x00000004       /* (Floating-point) Emulation. */
+#define CR0_TS 0x00000008       /* Task Switched. */
+#define CR0_NE 0x00000020       /* Numeric Error: report via #MF. */
+
+/* CR4 bits. */
+#define CR4_OSFXSR 0x00000200   /* FXSAVE and SSE enabled. */
+#define CR4_OSXMMEXCPT 0x00000400 /* Report SSE errors via #XF. */
+
+/* CPUID leaf 1 EDX bits. */
+#define CPUID_FXSR 0x01000000   /* FXSAVE/FXRSTOR. */
+#define CPUID_SSE 0x02000000    /* SSE. */
+
+/* FXSAVE area size and required alignment. */
+#define FXSAVE_SIZE 512
+#define FXSAVE_ALIGN 16
+
+/* Initial MXCSR: all SIMD exceptions masked, round to nearest. */
+#define MXCSR_DEFAULT 0x1f80
+
+/* Can threads use the FPU?  False if the CPU lacks FXSAVE, in
+   which case CR0.EM stays set and every FPU instruction raises
+   #NM. */
+static bool fpu_available;
+static bool sse_available;
+
+static inline uint32_t
+read_cr0 (void) 
+{
+  uint32_t cr0;
+  asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+  return cr0;
+}
+
+static inline void
+write_cr0 (uint32_t cr0) 
+{
+  asm volatile ("movl %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+/* Clears CR0.TS, letting FPU instructions run. */
+static inline void
+clts (void) 
+{
+  asm volatile ("clts" : : : "memory");
+}
+
+/* Sets CR0.TS, so that the next FPU instruction raises #NM. */
+static inline void
+stts (void) 
+{
+  write_cr0 (read_cr0 () | CR0_TS);
+}
+
+/* Returns thread T's FXSAVE area, suitably aligned. */
+static void *
+fxsave_area (struct thread *t) 
+{
+  return (void *) ROUND_UP ((uintptr_t) t->fpu, FXSAVE_ALIGN);
+}
+
+/* Enables the FPU on the running CPU, if it has FXSAVE, with
+   CR0.TS set so that no thread owns it yet.  Called once on each
+   CPU as it starts up. */
+void
+fpu_init (void) 
+{
+  uint32_t eax, ebx, ecx, edx;
+  uint32_t cr0;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  fpu_available = (edx & CPUID_FXSR) != 0;
+  sse_available = (edx & CPUID_SSE) != 0;
+  if (!fpu_available)
+    return;
+
+  if (sse_available) 
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+    }
+
+  cr0 = read_cr0 ();
+  cr0 &= ~CR0_EM;
+  cr0 |= CR0_MP | CR0_NE | CR0_TS;
+  write_cr0 (cr0);
+}
+
+/* Gives the running thread the FPU, in response to #NM: saves
+   the registers of the thread that owns them on this CPU, if
+   any, then loads the running thread's, or a clean state the
+   first time it uses the FPU.  Returns false if the FPU is
+   unusable or memory for the state is short. */
+bool
+fpu_activate (void) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool first_use = false;
+  struct cpu *c;
+
+  if (!fpu_available)
+    return false;
+
+  if (cur->fpu == NULL) 
+    {
+      cur->fpu = malloc (FXSAVE_SIZE + FXSAVE_ALIGN - 1);
+      if (cur->fpu == NULL)
+        return false;
+      first_use = true;
+    }
+
+  /* Keep from being switched out or moved to another CPU
+     halfway. */
+  old_level = intr_disable ();
+  c = cpu_current ();
+  ASSERT (c->fpu_owner != cur);
+  clts ();
+  if (c->fpu_owner != NULL)
+    asm volatile ("fxsave %0" : "=m" (*(char (*)[FXSAVE_SIZE])
+                                      fxsave_area (c->fpu_owner)));
+  if (first_use) 
+    {
+      uint32_t mxcsr = MXCSR_DEFAULT;
+      asm volatile ("fninit");
+      if (sse_available)
+        asm volatile ("ldmxcsr %0" : : "m" (mxcsr));
+    }
+  else
+    asm volatile ("fxrstor %0" : : "m" (*(char (*)[FXSAVE_SIZE])
+                                         fxsave_area (cur)));
+  c->fpu_owner = cur;
+  intr_set_level (old_level);
+
+  return true;
+}
+
+/* Called by thread_schedule_tail() after a thread switch, with
+   interrupts off.  Sets CR0.TS unless the running thread's state
+   is still in the registers.
+
+   With one CPU the registers may keep a switched-out thread's
+   state indefinitely.  With more, that thread may next run on
+   another CPU, which could not get at our registers, so save its
+   state now; loading it is still deferred until first use. */
+void
+fpu_switch (void) 
+{
+  struct cpu *c = cpu_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!fpu_available)
+    return;
+
+  if (cpu_cnt > 1 && c->fpu_owner != NULL && c->fpu_owner != c->current) 
+    {
+      clts ();
+      asm volatile ("fxsave %0" : "=m" (*(char (*)[FXSAVE_SIZE])
+                                        fxsave_area (c->fpu_owner)));
+      c->fpu_owner = NULL;
+    }
+
+  if (c->fpu_owner == c->current)
+    clts ();
+  else
+    stts ();
+}
+
+/* Discards the running thread's FPU state, as it exits. */
+void
+fpu_release (void) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (cur->fpu == NULL)
+    return;
+
+  old_level = intr_disable ();
+  if (cpu_current ()->fpu_owner == cur) 
+    {
+      cpu_current ()->fpu_owner = NULL;
+      stts ();
+    }
+  intr_set_level (old_level);
+
+  free (cur->fpu);
+  cur->fpu = NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef THREADS_FPU_H
+#define THREADS_FPU_H
+
+#include <stdbool.h>
+
+/* Lazy x87/SSE state switching.
+
+   The kernel is compiled with -msoft-float and never touches the
+   FPU, so only user code does.  A thread gets an FXSAVE area the
+   first time it executes an FPU instruction.  Switching threads
+   just sets CR0.TS; the next FPU instruction then raises #NM,
+   whose handler calls fpu_activate() to save the previous
+   owner's registers and load the current thread's.  A thread
+   that does not use the FPU in its time slice costs nothing. */
+
+void fpu_init (void);
+bool fpu_activate (void);
+void fpu_switch (void);
+void fpu_release (void);
+
+#endif /* threads/fpu.h */
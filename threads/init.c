@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <random.h>
+#include <round.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,13 +16,19 @@
 #include "devices/timer.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/softirq.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -37,6 +44,10 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/page.h"
+#include "vm/swap.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -57,6 +68,14 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -trace: Trace events?  Name of block device to dump them to, or
+   a null pointer to dump to the console. */
+static bool trace;
+static const char *trace_dev_name;
+
+/* -prof: Profile? */
+static bool profile;
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -107,6 +126,9 @@ main (void)
 
   /* Initialize interrupt handlers. */
   intr_init ();
+  fpu_init ();
+  softirq_init ();
+  workqueue_init ();
   timer_init ();
   kbd_init ();
   input_init ();
@@ -114,18 +136,34 @@ main (void)
   exception_init ();
   syscall_init ();
 #endif
+#ifdef VM
+  page_init ();
+#endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  softirq_start ();
+  workqueue_start ();
+  palloc_start_zeroing ();
   serial_init_queue ();
   timer_calibrate ();
 
+  /* Bring up the other CPUs, if any. */
+  smp_init ();
+  if (trace)
+    trace_init (trace_dev_name);
+  if (profile)
+    profile_init ();
+
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
+#ifdef VM
+  swap_init ();
+#endif
 
   printf ("Boot complete.\n");
   
@@ -251,11 +289,29 @@ parse_options (char **argv)
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
 #endif
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-stack")) 
+        {
+          int kb = atoi (value);
+          if (kb <= 0 || kb > MAIN_STACK_SIZE / 1024)
+            PANIC ("stack limit must be 1 to %d kB", MAIN_STACK_SIZE / 1024);
+          user_stack_limit = ROUND_UP ((size_t) kb * 1024, PGSIZE);
+        }
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-thread-stats"))
+        thread_report_stats = true;
+      else if (!strcmp (name, "-trace")) 
+        {
+          trace = true;
+          trace_dev_name = value;
+        }
+      else if (!strcmp (name, "-prof"))
+        profile = true;
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -379,8 +435,14 @@ usage (void)
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -thread-stats      Print scheduling statistics at thread exit.\n"
+          "  -trace[=BDEV]      Trace events, dump to BDEV or console at exit.\n"
+          "  -prof              Profile by sampling at each timer tick.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -stack=KB          Limit each user stack to KB kB.\n"
 #endif
           );
   shutdown_power_off ();
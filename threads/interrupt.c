@@ -6,9 +6,17 @@
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/smp.h"
+#include "threads/softirq.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/apic.h"
 #include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -38,14 +46,24 @@ static const char *intr_names[INTR_CNT];
 static unsigned int unexpected_cnt[INTR_CNT];
 
 /* External interrupts are those generated by devices outside the
-   CPU, such as the timer.  External interrupts run with
-   interrupts turned off, so they never nest, nor are they ever
-   pre-empted.  Handlers for external interrupts also may not
-   sleep, although they may invoke intr_yield_on_return() to
-   request that a new process be scheduled just before the
-   interrupt returns. */
-static bool in_external_intr;   /* Are we processing an external interrupt? */
-static bool yield_on_return;    /* Should we yield on interrupt return? */
+   CPU, such as the timer, and interprocessor interrupts (IPIs).
+   External interrupts run with interrupts turned off, so they
+   never nest, nor are they ever pre-empted.  Handlers for
+   external interrupts also may not sleep, although they may
+   invoke intr_yield_on_return() to request that a new process be
+   scheduled just before the interrupt returns.  Whether a CPU is
+   processing an external interrupt, and whether it should yield
+   on return, is kept in its struct cpu. */
+
+/* With more than one CPU, turning interrupts off only keeps out
+   interrupt handlers on the same CPU.  Once smp_enabled is set,
+   a CPU with interrupts off therefore also holds this lock, so
+   that code that disables interrupts still runs atomically with
+   respect to every other CPU.  The lock belongs to a CPU, not a
+   thread: a thread that switches away with interrupts off hands
+   it to the next thread on the same CPU, just as it hands over
+   the interrupts-off state. */
+static struct spinlock intr_lock;
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
@@ -55,6 +73,11 @@ static void pic_end_of_interrupt (int irq);
 static uint64_t make_intr_gate (void (*) (void), int dpl);
 static uint64_t make_trap_gate (void (*) (void), int dpl);
 static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
+static void load_idt (void);
+
+/* Helpers for intr_lock. */
+static void intr_lock_acquire (void);
+static void intr_lock_release (void);
 
 /* Interrupt handlers. */
 void intr_handler (struct intr_frame *args);
@@ -90,6 +113,9 @@ intr_enable (void)
   enum intr_level old_level = intr_get_level ();
   ASSERT (!intr_context ());
 
+  if (old_level == INTR_OFF)
+    intr_lock_release ();
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -110,28 +136,69 @@ intr_disable (void)
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
 
+  if (old_level == INTR_ON)
+    intr_lock_acquire ();
+
   return old_level;
 }
+
+/* Enables interrupts and waits, in a low-power state, for the
+   next one.  Must be called with interrupts off. */
+void
+intr_enable_and_wait (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!intr_context ());
+
+  intr_lock_release ();
+
+  /* STI delays recognition of interrupts until after the next
+     instruction, so no interrupt can slip in before HLT.  See
+     [IA32-v2a] "HLT" and [IA32-v2b] "STI". */
+  asm volatile ("sti; hlt" : : : "memory");
+}
+
+/* Acquires intr_lock for the running CPU, which must have
+   interrupts off, if it needs and lacks it.  While spinning,
+   carries out TLB shootdowns requested by the holder, which
+   cannot otherwise reach us. */
+static void
+intr_lock_acquire (void) 
+{
+  if (!smp_enabled || spinlock_held (&intr_lock))
+    return;
+
+  while (!spinlock_try_acquire (&intr_lock))
+    {
+      smp_poll ();
+      asm volatile ("pause" : : : "memory");
+    }
+}
+
+/* Releases intr_lock if the running CPU, which must have
+   interrupts off, holds it. */
+static void
+intr_lock_release (void) 
+{
+  if (smp_enabled && spinlock_held (&intr_lock))
+    spinlock_release (&intr_lock);
+}
 
 /* Initializes the interrupt system. */
 void
 intr_init (void)
 {
-  uint64_t idtr_operand;
   int i;
 
   /* Initialize interrupt controller. */
   pic_init ();
+  spinlock_init (&intr_lock);
 
   /* Initialize IDT. */
   for (i = 0; i < INTR_CNT; i++)
     idt[i] = make_intr_gate (intr_stubs[i], 0);
 
-  /* Load IDT register.
-     See [IA32-v2a] "LIDT" and [IA32-v3a] 5.10 "Interrupt
-     Descriptor Table (IDT)". */
-  idtr_operand = make_idtr_operand (sizeof idt - 1, idt);
-  asm volatile ("lidt %0" : : "m" (idtr_operand));
+  load_idt ();
 
   /* Initialize intr_names. */
   for (i = 0; i < INTR_CNT; i++)
@@ -157,6 +224,24 @@ intr_init (void)
   intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Initializes interrupt handling on an application processor,
+   which shares the BSP's IDT. */
+void
+intr_init_ap (void) 
+{
+  load_idt ();
+}
+
+/* Loads the IDT register.
+   See [IA32-v2a] "LIDT" and [IA32-v3a] 5.10 "Interrupt
+   Descriptor Table (IDT)". */
+static void
+load_idt (void) 
+{
+  uint64_t idtr_operand = make_idtr_operand (sizeof idt - 1, idt);
+  asm volatile ("lidt %0" : : "m" (idtr_operand));
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -185,6 +270,17 @@ intr_register_ext (uint8_t vec_no, intr_handler_func *handler,
   register_handler (vec_no, 0, INTR_OFF, handler, name);
 }
 
+/* Registers interprocessor interrupt VEC_NO to invoke HANDLER,
+   which is named NAME for debugging purposes.  The handler will
+   execute with interrupts disabled, as an external interrupt. */
+void
+intr_register_ipi (uint8_t vec_no, intr_handler_func *handler,
+                   const char *name) 
+{
+  ASSERT (vec_no >= 0xf0 && vec_no <= 0xfe);
+  register_handler (vec_no, 0, INTR_OFF, handler, name);
+}
+
 /* Registers internal interrupt VEC_NO to invoke HANDLER, which
    is named NAME for debugging purposes.  The interrupt handler
    will be invoked with interrupt status LEVEL.
@@ -202,7 +298,7 @@ void
 intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
                    intr_handler_func *handler, const char *name)
 {
-  ASSERT (vec_no < 0x20 || vec_no > 0x2f);
+  ASSERT ((vec_no < 0x20 || vec_no > 0x2f) && vec_no < 0xf0);
   register_handler (vec_no, dpl, level, handler, name);
 }
 
@@ -211,7 +307,10 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
 bool
 intr_context (void) 
 {
-  return in_external_intr;
+  /* External interrupts always run with interrupts off.  Checking
+     that first also keeps us from looking at our struct cpu
+     while we could be moved to another CPU. */
+  return intr_get_level () == INTR_OFF && cpu_current ()->in_external_intr;
 }
 
 /* During processing of an external interrupt, directs the
@@ -222,7 +321,7 @@ void
 intr_yield_on_return (void) 
 {
   ASSERT (intr_context ());
-  yield_on_return = true;
+  cpu_current ()->yield_on_return = true;
 }
 
 /* 8259A Programmable Interrupt Controller. */
@@ -346,26 +445,37 @@ intr_handler (struct intr_frame *frame)
 {
   bool external;
   intr_handler_func *handler;
+  struct cpu *cpu = NULL;
+  bool yield;
+
+  /* Entering through an interrupt gate turned interrupts off, so
+     take intr_lock as intr_disable() would have. */
+  if (intr_get_level () == INTR_OFF)
+    intr_lock_acquire ();
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
-     and they need to be acknowledged on the PIC (see below).
+     and they need to be acknowledged on the PIC or local APIC
+     (see below).
      An external interrupt handler cannot sleep. */
-  external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+  external = ((frame->vec_no >= 0x20 && frame->vec_no < 0x30)
+              || (frame->vec_no >= 0xf0 && frame->vec_no < 0xff));
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (!intr_context ());
 
-      in_external_intr = true;
-      yield_on_return = false;
+      cpu = cpu_current ();
+      cpu->in_external_intr = true;
+      cpu->yield_on_return = false;
     }
 
   /* Invoke the interrupt's handler. */
   handler = intr_handlers[frame->vec_no];
   if (handler != NULL)
     handler (frame);
-  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f)
+  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f
+           || frame->vec_no == 0xff)
     {
       /* There is no handler, but this interrupt can trigger
          spuriously due to a hardware fault or hardware race
@@ -380,12 +490,38 @@ intr_handler (struct intr_frame *frame)
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (intr_context ());
 
-      in_external_intr = false;
-      pic_end_of_interrupt (frame->vec_no); 
+      cpu->in_external_intr = false;
+      if (frame->vec_no < 0x30)
+        pic_end_of_interrupt (frame->vec_no); 
+      else
+        lapic_eoi ();
+
+      /* Run deferred work.  Interrupts nested in it reset
+         yield_on_return, so look at it first. */
+      yield = cpu->yield_on_return;
+      if (softirq_intr_exit ())
+        yield = true;
+
+      /* We may come back from thread_preempt() on another CPU. */
+      if (yield) 
+        thread_preempt (); 
+    }
 
-      if (yield_on_return) 
-        thread_yield (); 
+#ifdef USERPROG
+  /* A thread whose process is exiting must not go back to user
+     mode. */
+  if (frame->cs == SEL_UCSEG && process_exiting ())
+    {
+      if (external)
+        intr_enable ();
+      thread_exit ();
     }
+#endif
+
+  /* intr_exit will turn interrupts back on if they were on when
+     the interrupt occurred. */
+  if (intr_get_level () == INTR_OFF && (frame->eflags & FLAG_IF))
+    intr_lock_release ();
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
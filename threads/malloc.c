@@ -5,17 +5,19 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
    The size of each request, in bytes, is rounded up to a power
    of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
-   the free list is nonempty, one of its blocks is used to
-   satisfy the request.
+   that size, found by looking the size up in size_class[].  The
+   descriptor keeps a list of free blocks.  If the free list is
+   nonempty, one of its blocks is used to satisfy the request.
 
    Otherwise, a new page of memory, called an "arena", is
    obtained from the page allocator (if none is available,
@@ -24,15 +26,34 @@
    list.  Then we return one of the new blocks.
 
    When we free a block, we add it to its descriptor's free list.
-   But if the arena that the block was in now has no in-use
-   blocks, we remove all of the arena's blocks from the free list
-   and give the arena back to the page allocator.
-
-   We can't handle blocks bigger than 2 kB using this scheme,
+   If the arena that the block was in now has no in-use blocks,
+   it is kept for reuse, unless the descriptor already has
+   ARENA_KEEP such empty arenas, in which case we remove all of
+   the arena's blocks from the free list and give the arena back
+   to the page allocator.  Keeping a few around stops a
+   descriptor whose use hovers around an arena boundary from
+   going to the page allocator on every other call.
+
+   Each thread also keeps a small cache of free blocks of each
+   size in its struct thread, which malloc() and free() use
+   without taking the descriptor's lock.  Blocks move between
+   the cache and the descriptor's free list MALLOC_BATCH at a
+   time, and as far as the arenas are concerned, blocks in a
+   cache are in use.  A thread's cache is emptied when it exits.
+
+   We can't handle blocks bigger than 1 kB using this scheme,
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   Each descriptor counts its arenas and the blocks it has handed
+   out, which malloc_print_stats() prints along with the blocks
+   sitting in thread caches.  If MALLOC_PROFILE is defined (e.g.
+   add -DMALLOC_PROFILE to DEFINES in a Make.vars file), every
+   block also carries a struct malloc_tag in front of it, naming
+   the call site that allocated it, so that the sites with blocks
+   still live can be printed: a quick way to find leaks. */
 
 /* Descriptor. */
 struct desc
@@ -40,7 +61,14 @@ struct desc
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
+    size_t empty_cnt;           /* Number of arenas with no blocks in use. */
     struct lock lock;           /* Lock. */
+
+    /* Statistics, protected by LOCK. */
+    size_t arena_cnt;           /* Number of arenas. */
+    size_t peak_arena_cnt;      /* Most arenas at once. */
+    size_t out_cnt;             /* Blocks in use or in thread caches. */
+    size_t peak_out_cnt;        /* Most blocks out at once. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -58,29 +86,95 @@ struct arena
 struct block 
   {
     struct list_elem free_elem; /* Free list element. */
+    struct block *next;         /* Next block in a thread's cache. */
   };
 
+/* Largest block a descriptor hands out. */
+#define MAX_BLOCK_SIZE 1024
+
+/* Number of empty arenas each descriptor keeps. */
+#define ARENA_KEEP 2
+
+/* Maximum number of blocks of each size in a thread's cache, and
+   number moved to or from the descriptor at a time. */
+#define MALLOC_CACHE_MAX 8
+#define MALLOC_BATCH 4
+
 /* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
+static struct desc descs[MALLOC_CLASSES]; /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
+/* Maps (SIZE - 1) / 16 to the index of the descriptor for a
+   SIZE-byte request. */
+static uint8_t size_class[MAX_BLOCK_SIZE / 16];
+
+/* Big block statistics.  Protected by disabling interrupts. */
+static size_t big_cnt;          /* Number of big blocks. */
+static size_t big_pages;        /* Pages in big blocks. */
+static size_t peak_big_pages;   /* Most pages in big blocks at once. */
+
+#ifdef MALLOC_PROFILE
+/* Allocation statistics for one call site. */
+struct malloc_site
+  {
+    void *pc;                   /* Caller of malloc(), etc. */
+    long long allocs;           /* Number of allocations. */
+    long long frees;            /* Number of those freed. */
+    size_t live_bytes;          /* Bytes allocated and not freed. */
+    size_t peak_live_bytes;     /* Most LIVE_BYTES at once. */
+  };
+
+/* Header in front of each block under MALLOC_PROFILE. */
+struct malloc_tag
+  {
+    struct malloc_site *site;   /* Site that allocated the block. */
+    size_t size;                /* Size requested. */
+  };
+
+/* Hash table of call sites, with linear probing.  Sites are
+   never removed.  Sites that do not fit are lumped together in
+   overflow_site.  Protected by disabling interrupts. */
+#define MALLOC_SITE_CNT 256
+static struct malloc_site sites[MALLOC_SITE_CNT];
+static struct malloc_site overflow_site;
+
+static struct malloc_site *site_lookup (void *pc);
+#endif
+
+static void *malloc_at (size_t, void *site);
+static void *malloc_block (size_t);
+static void free_block (void *);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static bool cache_refill (struct desc *, struct malloc_cache *);
+static void cache_drain (struct desc *, struct malloc_cache *, size_t cnt);
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) 
 {
   size_t block_size;
+  size_t i;
 
-  for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
+  for (block_size = 16; block_size <= MAX_BLOCK_SIZE; block_size *= 2)
     {
       struct desc *d = &descs[desc_cnt++];
       ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
-      lock_init (&d->lock);
+      d->empty_cnt = 0;
+      lock_init_adaptive (&d->lock);
+    }
+  ASSERT (desc_cnt == MALLOC_CLASSES);
+
+  for (i = 0; i < sizeof size_class; i++) 
+    {
+      size_t size = (i + 1) * 16;
+      size_t class = 0;
+      while (descs[class].block_size < size)
+        class++;
+      size_class[i] = class;
     }
 }
 
@@ -89,20 +183,26 @@ malloc_init (void)
 void *
 malloc (size_t size) 
 {
+  return malloc_at (size, __builtin_return_address (0));
+}
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+static void *
+malloc_block (size_t size) 
+{
+  struct malloc_cache *c;
   struct desc *d;
   struct block *b;
   struct arena *a;
+  enum intr_level old_level;
+  size_t class;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
     return NULL;
 
-  /* Find the smallest descriptor that satisfies a SIZE-byte
-     request. */
-  for (d = descs; d < descs + desc_cnt; d++)
-    if (d->block_size >= size)
-      break;
-  if (d == descs + desc_cnt) 
+  if (size > MAX_BLOCK_SIZE) 
     {
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
@@ -116,40 +216,28 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
+
+      old_level = intr_disable ();
+      big_cnt++;
+      big_pages += page_cnt;
+      if (big_pages > peak_big_pages)
+        peak_big_pages = big_pages;
+      intr_set_level (old_level);
       return a + 1;
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
-    {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
-
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
-    }
+  /* Take a block from our cache of blocks of the smallest
+     descriptor that satisfies a SIZE-byte request, refilling it
+     if it is empty. */
+  class = size_class[(size - 1) / 16];
+  d = &descs[class];
+  c = &thread_current ()->malloc_cache;
+  if (c->cnt[class] == 0 && !cache_refill (d, c))
+    return NULL;
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
+  b = c->blocks[class];
+  c->blocks[class] = b->next;
+  c->cnt[class]--;
   return b;
 }
 
@@ -167,13 +255,14 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = malloc_at (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
   return p;
 }
 
+#ifndef MALLOC_PROFILE
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) 
@@ -184,6 +273,19 @@ block_size (void *block)
 
   return d != NULL ? d->block_size : PGSIZE * a->free_cnt - pg_ofs (block);
 }
+#endif
+
+/* Returns the number of bytes the caller may use in BLOCK,
+   returned by malloc_at(). */
+static size_t
+usable_size (void *block) 
+{
+#ifdef MALLOC_PROFILE
+  return ((struct malloc_tag *) block - 1)->size;
+#else
+  return block_size (block);
+#endif
+}
 
 /* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
    moving it in the process.
@@ -201,10 +303,10 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = malloc_at (new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
-          size_t old_size = block_size (old_block);
+          size_t old_size = usable_size (old_block);
           size_t min_size = new_size < old_size ? new_size : old_size;
           memcpy (new_block, old_block, min_size);
           free (old_block);
@@ -217,6 +319,27 @@ realloc (void *old_block, size_t new_size)
    malloc(), calloc(), or realloc(). */
 void
 free (void *p) 
+{
+  if (p == NULL)
+    return;
+
+#ifdef MALLOC_PROFILE
+  {
+    struct malloc_tag *tag = (struct malloc_tag *) p - 1;
+    enum intr_level old_level = intr_disable ();
+    tag->site->frees++;
+    tag->site->live_bytes -= tag->size;
+    intr_set_level (old_level);
+    p = tag;
+  }
+#endif
+  free_block (p);
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc_block(). */
+static void
+free_block (void *p) 
 {
   if (p != NULL)
     {
@@ -226,43 +349,269 @@ free (void *p)
       
       if (d != NULL) 
         {
-          /* It's a normal block.  We handle it here. */
+          /* It's a normal block.  We put it in our cache. */
+          struct malloc_cache *c = &thread_current ()->malloc_cache;
+          size_t class = d - descs;
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
+          b->next = c->blocks[class];
+          c->blocks[class] = b;
+          if (++c->cnt[class] > MALLOC_CACHE_MAX)
+            cache_drain (d, c, MALLOC_BATCH);
+        }
+      else
+        {
+          /* It's a big block.  Free its pages. */
+          enum intr_level old_level = intr_disable ();
+          big_cnt--;
+          big_pages -= a->free_cnt;
+          intr_set_level (old_level);
+
+          palloc_free_multiple (a, a->free_cnt);
+          return;
+        }
+    }
+}
+
+/* Returns the blocks in the running thread's cache to their
+   descriptors.  Called when the thread exits. */
+void
+malloc_thread_exit (void) 
+{
+  struct malloc_cache *c = &thread_current ()->malloc_cache;
+  size_t class;
 
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+  for (class = 0; class < desc_cnt; class++)
+    if (c->cnt[class] > 0)
+      cache_drain (&descs[class], c, c->cnt[class]);
+}
+
+/* Moves up to MALLOC_BATCH free blocks from descriptor D into
+   cache C, creating a new arena if D has none.  Returns true if
+   at least one block was moved, false if memory is short. */
+static bool
+cache_refill (struct desc *d, struct malloc_cache *c) 
+{
+  size_t class = d - descs;
+  size_t i;
+
+  lock_acquire (&d->lock);
+  for (i = 0; i < MALLOC_BATCH; i++) 
+    {
+      struct block *b;
+      struct arena *a;
+
+      /* If the free list is empty, create a new arena. */
+      if (list_empty (&d->free_list))
+        {
+          size_t j;
+
+          /* Allocate a page. */
+          a = palloc_get_page (0);
+          if (a == NULL) 
+            break;
+
+          /* Initialize arena and add its blocks to the free list. */
+          a->magic = ARENA_MAGIC;
+          a->desc = d;
+          a->free_cnt = d->blocks_per_arena;
+          d->empty_cnt++;
+          if (++d->arena_cnt > d->peak_arena_cnt)
+            d->peak_arena_cnt = d->arena_cnt;
+          for (j = 0; j < d->blocks_per_arena; j++) 
+            {
+              struct block *b = arena_to_block (a, j);
+              list_push_back (&d->free_list, &b->free_elem);
+            }
+        }
+
+      /* Move a block from the free list to the cache. */
+      b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
+      a = block_to_arena (b);
+      if (a->free_cnt-- == d->blocks_per_arena)
+        d->empty_cnt--;
+      b->next = c->blocks[class];
+      c->blocks[class] = b;
+      c->cnt[class]++;
+      if (++d->out_cnt > d->peak_out_cnt)
+        d->peak_out_cnt = d->out_cnt;
+    }
+  lock_release (&d->lock);
+
+  return i > 0;
+}
+
+/* Moves CNT blocks from cache C back to descriptor D's free
+   list, freeing arenas that become empty beyond ARENA_KEEP. */
+static void
+cache_drain (struct desc *d, struct malloc_cache *c, size_t cnt) 
+{
+  size_t class = d - descs;
+
+  ASSERT (cnt <= c->cnt[class]);
+
+  lock_acquire (&d->lock);
+  c->cnt[class] -= cnt;
+  d->out_cnt -= cnt;
+  while (cnt-- > 0) 
+    {
+      struct block *b = c->blocks[class];
+      struct arena *a = block_to_arena (b);
+
+      c->blocks[class] = b->next;
+
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
+
+      /* If the arena is now entirely unused, keep it if we have
+         few such, otherwise free it. */
+      if (++a->free_cnt >= d->blocks_per_arena) 
+        {
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          if (d->empty_cnt < ARENA_KEEP)
+            d->empty_cnt++;
+          else 
             {
               size_t i;
 
-              ASSERT (a->free_cnt == d->blocks_per_arena);
               for (i = 0; i < d->blocks_per_arena; i++) 
                 {
                   struct block *b = arena_to_block (a, i);
                   list_remove (&b->free_elem);
                 }
               palloc_free_page (a);
+              d->arena_cnt--;
             }
-
-          lock_release (&d->lock);
         }
-      else
+    }
+  lock_release (&d->lock);
+}
+
+/* Obtains and returns a new block of at least SIZE bytes on
+   behalf of code at SITE, for MALLOC_PROFILE.  Returns a null
+   pointer if memory is not available. */
+static void *
+malloc_at (size_t size, void *site UNUSED) 
+{
+#ifdef MALLOC_PROFILE
+  struct malloc_tag *tag;
+  enum intr_level old_level;
+
+  if (size == 0)
+    return NULL;
+  tag = malloc_block (size + sizeof *tag);
+  if (tag == NULL)
+    return NULL;
+
+  old_level = intr_disable ();
+  tag->site = site_lookup (site);
+  tag->size = size;
+  tag->site->allocs++;
+  tag->site->live_bytes += size;
+  if (tag->site->live_bytes > tag->site->peak_live_bytes)
+    tag->site->peak_live_bytes = tag->site->live_bytes;
+  intr_set_level (old_level);
+  return tag + 1;
+#else
+  return malloc_block (size);
+#endif
+}
+
+/* Adds the number of blocks of each size in thread T's cache to
+   the counts in CACHED_. */
+static void
+count_cached (struct thread *t, void *cached_) 
+{
+  size_t *cached = cached_;
+  size_t class;
+
+  for (class = 0; class < MALLOC_CLASSES; class++)
+    cached[class] += t->malloc_cache.cnt[class];
+}
+
+/* Prints memory usage for each block size and for big blocks
+   and, if MALLOC_PROFILE is defined, the call sites that have
+   blocks still allocated.  Sites are printed as code addresses;
+   pass them to the `backtrace' utility to translate them into
+   function names and line numbers. */
+void
+malloc_print_stats (void) 
+{
+  size_t cached[MALLOC_CLASSES];
+  enum intr_level old_level;
+  size_t class;
+
+  memset (cached, 0, sizeof cached);
+  old_level = intr_disable ();
+  thread_foreach (count_cached, cached);
+  intr_set_level (old_level);
+
+  for (class = 0; class < desc_cnt; class++) 
+    {
+      struct desc *d = &descs[class];
+      size_t in_use = d->out_cnt - cached[class];
+
+      if (d->peak_arena_cnt == 0)
+        continue;
+      printf ("Malloc: %zu-byte blocks: %zu in use (%zu bytes), "
+              "%zu cached, %zu free, peak %zu out; "
+              "%zu arenas, peak %zu\n",
+              d->block_size, in_use, in_use * d->block_size, cached[class],
+              d->arena_cnt * d->blocks_per_arena - d->out_cnt,
+              d->peak_out_cnt, d->arena_cnt, d->peak_arena_cnt);
+    }
+  printf ("Malloc: big blocks: %zu using %zu pages, peak %zu pages\n",
+          big_cnt, big_pages, peak_big_pages);
+
+#ifdef MALLOC_PROFILE
+  {
+    size_t i;
+
+    printf ("Malloc profile of live sites (site, allocs, frees, "
+            "live bytes, peak live bytes):\n");
+    for (i = 0; i <= MALLOC_SITE_CNT; i++) 
+      {
+        const struct malloc_site *s
+          = i < MALLOC_SITE_CNT ? &sites[i] : &overflow_site;
+        if (s->allocs == s->frees)
+          continue;
+        printf (" %10p %8lld %8lld %10zu %10zu\n", s->pc, s->allocs,
+                s->frees, s->live_bytes, s->peak_live_bytes);
+      }
+  }
+#endif
+}
+
+#ifdef MALLOC_PROFILE
+/* Returns the statistics for call site PC, creating them if
+   necessary.  Interrupts must be off. */
+static struct malloc_site *
+site_lookup (void *pc) 
+{
+  unsigned hash = (uintptr_t) pc * 2654435761u >> 24;
+  size_t i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < MALLOC_SITE_CNT; i++) 
+    {
+      struct malloc_site *s = &sites[(hash + i) % MALLOC_SITE_CNT];
+      if (s->pc == pc)
+        return s;
+      if (s->pc == NULL) 
         {
-          /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
-          return;
+          s->pc = pc;
+          return s;
         }
     }
+  return &overflow_site;
 }
-
+#endif
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
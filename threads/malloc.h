@@ -3,11 +3,26 @@
 
 #include <debug.h>
 #include <stddef.h>
+#include <stdint.h>
+
+/* Number of block sizes, 16 to 1024 bytes, that malloc() hands
+   out from arenas. */
+#define MALLOC_CLASSES 7
+
+/* A thread's cache of free blocks, one list per block size.
+   See malloc.c. */
+struct malloc_cache
+  {
+    void *blocks[MALLOC_CLASSES];       /* First free block of each size. */
+    uint8_t cnt[MALLOC_CLASSES];        /* Number of blocks of each size. */
+  };
 
 void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
+void malloc_thread_exit (void);
+void malloc_print_stats (void);
 
 #endif /* threads/malloc.h */
@@ -2,14 +2,19 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/smp.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "threads/workqueue.h"
 
 /* Page allocator.  Hands out memory in page-size (or
    page-multiple) chunks.  See malloc.h for an allocator that
@@ -23,14 +28,77 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is managed as a binary buddy system.  A free block of
+   order K is 2**K pages whose index within the pool is a multiple
+   of 2**K, and sits on the pool's free list for order K, linked
+   through its first page.  An allocation of N pages takes a block
+   of the smallest order that fits, splitting larger blocks as
+   needed, and gives back the pages past the first N.  Freeing
+   merges a block with its "buddy", the other half of the block
+   of the next higher order, for as long as the buddy is free
+   too.  Both take time logarithmic in the size of the pool.
+
+   In debug builds, a bitmap of used pages is kept as well, to
+   catch double allocation and freeing of pages not in use.
+
+   Single pages, by far the most common request, come from a
+   small per-CPU "magazine" of free pages in front of each pool.
+   A CPU touches only its own magazines, with its interrupts off
+   but without taking any lock, and goes to the pool, under its
+   lock, only to refill an empty magazine or drain a full one, a
+   batch of pages at a time.  The price is that up to
+   MAGAZINE_SIZE pages per CPU per pool may sit in magazines,
+   where the pool cannot hand them out to other CPUs.
+
+   Finally, each pool keeps a stack of up to ZERO_PAGES pages that
+   have already been zeroed, so that single-page PAL_ZERO requests
+   need not wait for a memset.  A work queue whose one worker runs
+   at PRI_MIN, and so only when there is nothing else to do,
+   refills the stack whenever it falls below half full.  When a
+   pool is otherwise out of pages, its zeroed pages are handed out
+   to any request. */
+
+/* Largest block order, enough for a 1 GB pool. */
+#define MAX_ORDER 18
+
+/* Capacity of a magazine, and number of pages moved between a
+   magazine and its pool at a time. */
+#define MAGAZINE_SIZE 16
+#define MAGAZINE_BATCH 8
+
+/* Capacity of a pool's stack of zeroed pages. */
+#define ZERO_PAGES 32
+
+/* A CPU's cache of free pages from one pool. */
+struct magazine
+  {
+    size_t cnt;                         /* Number of pages. */
+    void *pages[MAGAZINE_SIZE];         /* Pages, most recently freed last. */
+  };
 
 /* A memory pool. */
 struct pool
   {
+    const char *name;                   /* Name, for statistics. */
     struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    size_t used_cnt;                    /* Pages not in free_lists. */
+    size_t peak_used_cnt;               /* Most pages used at once. */
+    uint8_t *free_order;                /* Per page: 1 + order of the
+                                           free block it heads, or 0. */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks, by order. */
+    struct magazine magazines[CPU_MAX]; /* Per-CPU page caches. */
+
+    struct spinlock zero_lock;          /* Protects the following. */
+    size_t zero_cnt;                    /* Number of zeroed pages. */
+    void *zero_pages[ZERO_PAGES];       /* Zeroed pages. */
+    struct work zero_work;              /* Refills zero_pages. */
+#ifndef NDEBUG
+    struct bitmap *used_map;            /* Bitmap of used pages. */
+#endif
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +107,20 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t alloc_pages (struct pool *, size_t page_cnt);
+static void free_pages (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t pool_get (struct pool *, void **pages, size_t page_cnt,
+                        size_t batch_cnt);
+static void pool_put (struct pool *, void **pages, size_t page_cnt,
+                      size_t batch_cnt);
+static void *magazine_get (struct pool *);
+static void magazine_put (struct pool *, void *page);
+static void *zeroed_get (struct pool *);
+static work_func refill_zeroed;
+
+/* Work queue that zeroes pages ahead of time, or a null pointer
+   before palloc_start_zeroing(). */
+static struct workqueue *zero_wq;
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -71,24 +153,30 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
-  void *pages;
-  size_t page_idx;
+  void *pages = NULL;
+  bool zeroed = false;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
-
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
+  if (page_cnt == 1) 
+    {
+      if (flags & PAL_ZERO) 
+        {
+          pages = zeroed_get (pool);
+          zeroed = pages != NULL;
+        }
+      if (pages == NULL)
+        pages = magazine_get (pool);
+      if (pages == NULL && !(flags & PAL_ZERO))
+        pages = zeroed_get (pool);
+    }
+  else if (pool_get (pool, &pages, page_cnt, 1) == 0)
     pages = NULL;
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -100,6 +188,18 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   return pages;
 }
 
+/* Starts zeroing pages ahead of PAL_ZERO requests.  Must be
+   called after workqueue_start(). */
+void
+palloc_start_zeroing (void) 
+{
+  zero_wq = workqueue_create ("pagezero", 1, PRI_MIN);
+  if (zero_wq == NULL)
+    return;
+  work_queue (zero_wq, &kernel_pool.zero_work);
+  work_queue (zero_wq, &user_pool.zero_work);
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -118,7 +218,6 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
-  size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -131,14 +230,14 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   else
     NOT_REACHED ();
 
-  page_idx = pg_no (pages) - pg_no (pool->base);
-
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  if (page_cnt == 1)
+    magazine_put (pool, pages);
+  else
+    pool_put (pool, &pages, page_cnt, 1);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +247,103 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Prints the usage and fragmentation of pool P. */
+static void
+print_pool_stats (struct pool *p) 
+{
+  size_t free_blocks[MAX_ORDER + 1];
+  size_t free_cnt = 0, largest = 0, cached = 0;
+  size_t zeroed;
+  int order, top = 0;
+  unsigned i;
+  bool locked;
+
+  /* We may be called at shutdown after a panic, perhaps with the
+     lock held, so do without it if need be. */
+  locked = !intr_context () && lock_try_acquire (&p->lock);
+  for (order = 0; order <= MAX_ORDER; order++) 
+    {
+      free_blocks[order] = list_size (&p->free_lists[order]);
+      if (free_blocks[order] > 0) 
+        {
+          free_cnt += free_blocks[order] << order;
+          largest = (size_t) 1 << order;
+          top = order;
+        }
+    }
+  if (locked)
+    lock_release (&p->lock);
+
+  /* Racy, but only off by a few pages. */
+  for (i = 0; i < cpu_cnt; i++)
+    cached += p->magazines[i].cnt;
+  zeroed = p->zero_cnt;
+
+  printf ("Palloc: %s: %zu of %zu pages in use, peak %zu; "
+          "%zu in magazines, %zu zeroed\n",
+          p->name, p->used_cnt - cached - zeroed, p->page_cnt,
+          p->peak_used_cnt, cached, zeroed);
+  printf ("Palloc: %s: %zu pages free, largest block %zu pages "
+          "(%zu%% fragmented), free blocks by order:",
+          p->name, free_cnt, largest,
+          free_cnt > 0 ? 100 - largest * 100 / free_cnt : 0);
+  for (order = 0; order <= top; order++)
+    printf (" %zu", free_blocks[order]);
+  printf ("\n");
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) 
+{
+  print_pool_stats (&kernel_pool);
+  print_pool_stats (&user_pool);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  /* We'll put the pool's free_order array (and, in debug
+     builds, its used_map) at its base.  Calculate the space needed for
+     them and subtract it from the pool's size. */
+  size_t meta_size = page_cnt;
+  size_t meta_pages;
+  int order;
+#ifndef NDEBUG
+  meta_size += bitmap_buf_size (page_cnt);
+#endif
+  meta_pages = DIV_ROUND_UP (meta_size, PGSIZE);
+  if (meta_pages > page_cnt)
+    PANIC ("Not enough memory in %s for page map.", name);
+  page_cnt -= meta_pages;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  p->name = name;
+  lock_init_adaptive (&p->lock);
+  p->base = (uint8_t *) base + meta_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  p->used_cnt = p->peak_used_cnt = 0;
+#ifndef NDEBUG
+  p->used_map = bitmap_create_in_buf (page_cnt, base,
+                                      bitmap_buf_size (page_cnt));
+  bitmap_set_all (p->used_map, true);
+  base = (uint8_t *) base + bitmap_buf_size (page_cnt);
+#endif
+  p->free_order = base;
+  memset (p->free_order, 0, page_cnt);
+  for (order = 0; order <= MAX_ORDER; order++)
+    list_init (&p->free_lists[order]);
+
+  spinlock_init (&p->zero_lock);
+  p->zero_cnt = 0;
+  work_init (&p->zero_work, refill_zeroed, p);
+
+  /* Everything starts out free. */
+  free_pages (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -176,7 +353,318 @@ page_from_pool (const struct pool *pool, void *page)
 {
   size_t page_no = pg_no (page);
   size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t end_page = start_page + pool->page_cnt;
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the list element in the first page of the block at
+   PAGE_IDX in POOL. */
+static struct list_elem *
+block_elem (struct pool *pool, size_t page_idx) 
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the index within POOL of the block whose first page
+   holds list element E. */
+static size_t
+block_idx (struct pool *pool, struct list_elem *e) 
+{
+  return pg_no (e) - pg_no (pool->base);
+}
+
+/* Puts the block of order ORDER at PAGE_IDX on POOL's free
+   list, without merging it with its buddy. */
+static void
+push_block (struct pool *pool, size_t page_idx, int order) 
+{
+  pool->free_order[page_idx] = order + 1;
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+}
+
+/* Frees the block of order ORDER at PAGE_IDX in POOL, merging
+   it with its buddy as long as that is free. */
+static void
+free_block (struct pool *pool, size_t page_idx, int order) 
+{
+  while (order < MAX_ORDER) 
+    {
+      size_t buddy_idx = page_idx ^ ((size_t) 1 << order);
+      if (buddy_idx >= pool->page_cnt
+          || pool->free_order[buddy_idx] != order + 1)
+        break;
+
+      list_remove (block_elem (pool, buddy_idx));
+      pool->free_order[buddy_idx] = 0;
+      if (buddy_idx < page_idx)
+        page_idx = buddy_idx;
+      order++;
+    }
+  push_block (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX in POOL, which need not
+   form a single block, as the largest aligned blocks that they
+   contain. */
+static void
+free_pages (struct pool *pool, size_t page_idx, size_t page_cnt) 
+{
+  size_t end = page_idx + page_cnt;
+
+  ASSERT (end <= pool->page_cnt);
+
+  while (page_idx < end) 
+    {
+      int order = 0;
+      while (order < MAX_ORDER
+             && page_idx % ((size_t) 2 << order) == 0
+             && page_idx + ((size_t) 2 << order) <= end)
+        order++;
+      free_block (pool, page_idx, order);
+      page_idx += (size_t) 1 << order;
+    }
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if there is no free block
+   large enough. */
+static size_t
+alloc_pages (struct pool *pool, size_t page_cnt) 
+{
+  int want, order;
+  size_t page_idx;
+
+  /* Smallest order that holds PAGE_CNT pages. */
+  for (want = 0; ((size_t) 1 << want) < page_cnt; want++)
+    if (want == MAX_ORDER)
+      return BITMAP_ERROR;
+
+  /* Smallest free block of at least that order. */
+  for (order = want; list_empty (&pool->free_lists[order]); order++)
+    if (order == MAX_ORDER)
+      return BITMAP_ERROR;
+  page_idx = block_idx (pool, list_pop_front (&pool->free_lists[order]));
+  pool->free_order[page_idx] = 0;
+
+  /* Split it down to size, freeing the upper halves. */
+  while (order > want) 
+    {
+      order--;
+      push_block (pool, page_idx + ((size_t) 1 << order), order);
+    }
+
+  /* Give back the pages past PAGE_CNT. */
+  if (page_cnt < ((size_t) 1 << want))
+    free_pages (pool, page_idx + page_cnt,
+                ((size_t) 1 << want) - page_cnt);
+
+  return page_idx;
+}
+
+/* Allocates BATCH_CNT runs of PAGE_CNT contiguous pages each from
+   POOL, storing their addresses in PAGES[].  Returns the number
+   of runs allocated, which is less than BATCH_CNT if the pool
+   runs out. */
+static size_t
+pool_get (struct pool *pool, void **pages, size_t page_cnt,
+          size_t batch_cnt) 
+{
+  size_t i;
+
+  lock_acquire (&pool->lock);
+  for (i = 0; i < batch_cnt; i++) 
+    {
+      size_t page_idx = alloc_pages (pool, page_cnt);
+      if (page_idx == BITMAP_ERROR)
+        break;
+#ifndef NDEBUG
+      ASSERT (bitmap_none (pool->used_map, page_idx, page_cnt));
+      bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+#endif
+      pages[i] = pool->base + PGSIZE * page_idx;
+    }
+  pool->used_cnt += i * page_cnt;
+  if (pool->used_cnt > pool->peak_used_cnt)
+    pool->peak_used_cnt = pool->used_cnt;
+  lock_release (&pool->lock);
+
+  return i;
+}
+
+/* Returns BATCH_CNT runs of PAGE_CNT contiguous pages each, at
+   the addresses in PAGES[], to POOL. */
+static void
+pool_put (struct pool *pool, void **pages, size_t page_cnt,
+          size_t batch_cnt) 
+{
+  size_t i;
+
+  lock_acquire (&pool->lock);
+  for (i = 0; i < batch_cnt; i++) 
+    {
+      size_t page_idx = pg_no (pages[i]) - pg_no (pool->base);
+#ifndef NDEBUG
+      ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+      bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+#endif
+      free_pages (pool, page_idx, page_cnt);
+    }
+  pool->used_cnt -= batch_cnt * page_cnt;
+  lock_release (&pool->lock);
+}
+
+/* Turns off interrupts on this CPU only, without taking the lock
+   that intr_disable() takes on SMP, and returns the previous
+   flags for local_intr_restore(). */
+static inline uint32_t
+local_intr_disable (void) 
+{
+  uint32_t flags;
+  asm volatile ("pushfl; popl %0; cli" : "=g" (flags) : : "memory");
+  return flags;
+}
+
+/* Restores the flags saved by local_intr_disable(). */
+static inline void
+local_intr_restore (uint32_t flags) 
+{
+  asm volatile ("pushl %0; popfl" : : "g" (flags) : "memory", "cc");
+}
+
+/* Returns a free page from the running CPU's magazine for POOL,
+   refilling it from POOL if it is empty, or a null pointer if
+   POOL is out of pages too. */
+static void *
+magazine_get (struct pool *pool) 
+{
+  void *batch[MAGAZINE_BATCH];
+  struct magazine *m;
+  void *page = NULL;
+  size_t cnt;
+  uint32_t flags;
+
+  flags = local_intr_disable ();
+  m = &pool->magazines[cpu_current ()->id];
+  if (m->cnt > 0)
+    page = m->pages[--m->cnt];
+  local_intr_restore (flags);
+  if (page != NULL)
+    return page;
+
+  /* Refill.  We may have moved to another CPU by the time the
+     pool lock is released, or another thread may have refilled
+     the magazine, so anything that no longer fits goes back. */
+  cnt = pool_get (pool, batch, 1, MAGAZINE_BATCH);
+  if (cnt == 0)
+    return NULL;
+  page = batch[--cnt];
+
+  flags = local_intr_disable ();
+  m = &pool->magazines[cpu_current ()->id];
+  while (cnt > 0 && m->cnt < MAGAZINE_SIZE)
+    m->pages[m->cnt++] = batch[--cnt];
+  local_intr_restore (flags);
+  if (cnt > 0)
+    pool_put (pool, batch, 1, cnt);
+
+  return page;
+}
+
+/* Puts PAGE, which belongs to POOL, in the running CPU's
+   magazine for POOL, draining a batch of pages from the magazine
+   back to POOL if it is full. */
+static void
+magazine_put (struct pool *pool, void *page) 
+{
+  void *batch[MAGAZINE_BATCH + 1];
+  struct magazine *m;
+  size_t cnt = 0;
+  uint32_t flags;
+
+  flags = local_intr_disable ();
+  m = &pool->magazines[cpu_current ()->id];
+#ifndef NDEBUG
+  {
+    size_t i;
+    for (i = 0; i < m->cnt; i++)
+      ASSERT (m->pages[i] != page);
+  }
+#endif
+  if (m->cnt < MAGAZINE_SIZE)
+    m->pages[m->cnt++] = page;
+  else 
+    {
+      while (cnt < MAGAZINE_BATCH)
+        batch[cnt++] = m->pages[--m->cnt];
+      batch[cnt++] = page;
+    }
+  local_intr_restore (flags);
+
+  if (cnt > 0)
+    pool_put (pool, batch, 1, cnt);
+}
+
+/* Returns a page from POOL's stack of zeroed pages, or a null
+   pointer if it is empty.  Asks for the stack to be refilled if
+   it is getting low. */
+static void *
+zeroed_get (struct pool *pool) 
+{
+  void *page = NULL;
+  bool low;
+  uint32_t flags;
+
+  flags = local_intr_disable ();
+  spinlock_acquire (&pool->zero_lock);
+  if (pool->zero_cnt > 0)
+    page = pool->zero_pages[--pool->zero_cnt];
+  low = pool->zero_cnt < ZERO_PAGES / 2;
+  spinlock_release (&pool->zero_lock);
+  local_intr_restore (flags);
+
+  if (low && zero_wq != NULL)
+    work_queue (zero_wq, &pool->zero_work);
+  return page;
+}
+
+/* Work function that fills the stack of zeroed pages of the pool
+   POOL_, for as long as the pool has pages to spare. */
+static void
+refill_zeroed (void *pool_) 
+{
+  struct pool *pool = pool_;
+
+  for (;;) 
+    {
+      bool full;
+      uint32_t flags;
+      void *page;
+
+      flags = local_intr_disable ();
+      spinlock_acquire (&pool->zero_lock);
+      full = pool->zero_cnt >= ZERO_PAGES;
+      spinlock_release (&pool->zero_lock);
+      local_intr_restore (flags);
+      if (full)
+        break;
+
+      page = magazine_get (pool);
+      if (page == NULL)
+        break;
+      memset (page, 0, PGSIZE);
+
+      flags = local_intr_disable ();
+      spinlock_acquire (&pool->zero_lock);
+      full = pool->zero_cnt >= ZERO_PAGES;
+      if (!full)
+        pool->zero_pages[pool->zero_cnt++] = page;
+      spinlock_release (&pool->zero_lock);
+      local_intr_restore (flags);
+      if (full) 
+        {
+          magazine_put (pool, page);
+          break;
+        }
+    }
+}
@@ -0,0 +1,151 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Size of the sample table. */
+#define PROFILE_PAGES 32
+#define PROFILE_SLOTS (PROFILE_PAGES * PGSIZE / sizeof (struct sample))
+
+/* Deepest kernel call stack recorded, including the interrupted
+   EIP itself. */
+#define PROFILE_DEPTH 12
+
+/* A distinct sample and the number of times it was taken. */
+struct sample
+  {
+    uint32_t count;             /* Times taken; 0 if slot is free. */
+    uint16_t depth;             /* Number of PCS in use. */
+    bool user;                  /* Interrupted in user mode? */
+    uint32_t pcs[PROFILE_DEPTH]; /* EIP, then return addresses. */
+  };
+
+/* Open-addressed hash table of samples, and statistics. */
+static struct sample *samples;
+static unsigned long long sample_cnt;   /* Samples taken. */
+static unsigned long long dropped_cnt;  /* Samples lost to a full table. */
+
+/* True while samples are being taken. */
+bool profile_enabled;
+
+/* Starts profiling. */
+void
+profile_init (void) 
+{
+  samples = palloc_get_multiple (PAL_ZERO, PROFILE_PAGES);
+  if (samples == NULL) 
+    {
+      printf ("prof: out of memory, profiling disabled\n");
+      return;
+    }
+  profile_enabled = true;
+}
+
+/* Returns a hash of sample S's key, that is, everything except
+   its count. */
+static unsigned
+hash_sample (const struct sample *s) 
+{
+  unsigned hash = s->user;
+  int i;
+
+  for (i = 0; i < s->depth; i++)
+    hash = hash * 31 + s->pcs[i];
+  return hash;
+}
+
+/* Records a sample of the code that F interrupted.  Called from
+   the timer interrupt, or the timer tick IPI on the other CPUs;
+   on SMP those run under the interrupt lock, which serializes
+   access to the table. */
+void
+profile_sample (const struct intr_frame *f) 
+{
+  struct sample key;
+  unsigned i, slot;
+
+  ASSERT (intr_context ());
+
+  if (!profile_enabled)
+    return;
+  sample_cnt++;
+
+  memset (&key, 0, sizeof key);
+  key.pcs[0] = (uint32_t) f->eip;
+  key.depth = 1;
+  key.user = (f->cs & 3) == 3;
+  if (!key.user) 
+    {
+      /* Walk the chain of saved frame pointers, which lives in
+         the same page as F, that of the interrupted thread's
+         stack.  Make.config builds the kernel with frame
+         pointers; the checks stop the walk at the assembly
+         entry stubs, which do not keep one. */
+      uint32_t *fp = (uint32_t *) f->ebp;
+      while (key.depth < PROFILE_DEPTH
+             && pg_round_down (fp) == pg_round_down (f)
+             && (uintptr_t) fp % sizeof *fp == 0
+             && fp + 1 < (uint32_t *) pg_round_up (f)) 
+        {
+          uint32_t *next = (uint32_t *) fp[0];
+          key.pcs[key.depth++] = fp[1];
+          if (next <= fp)
+            break;
+          fp = next;
+        }
+    }
+
+  slot = hash_sample (&key) % PROFILE_SLOTS;
+  for (i = 0; i < PROFILE_SLOTS; i++, slot = (slot + 1) % PROFILE_SLOTS) 
+    {
+      struct sample *s = &samples[slot];
+      if (s->count == 0) 
+        {
+          *s = key;
+          s->count = 1;
+          return;
+        }
+      else if (s->depth == key.depth && s->user == key.user
+               && !memcmp (s->pcs, key.pcs, key.depth * sizeof *key.pcs)) 
+        {
+          s->count++;
+          return;
+        }
+    }
+  dropped_cnt++;
+}
+
+/* Stops profiling and prints the samples, one per line, as
+   "PROF MODE COUNT PC...", where MODE is "k" or "u" and the PCs
+   are the interrupted EIP and then, for the kernel, return
+   addresses from innermost outward. */
+void
+profile_dump (void) 
+{
+  enum intr_level old_level;
+  size_t i;
+
+  if (!profile_enabled)
+    return;
+  old_level = intr_disable ();
+  profile_enabled = false;
+  intr_set_level (old_level);
+
+  printf ("prof: %llu samples, %llu dropped\n", sample_cnt, dropped_cnt);
+  for (i = 0; i < PROFILE_SLOTS; i++) 
+    {
+      const struct sample *s = &samples[i];
+      int j;
+
+      if (s->count == 0)
+        continue;
+      printf ("PROF %c %"PRIu32, s->user ? 'u' : 'k', s->count);
+      for (j = 0; j < s->depth; j++)
+        printf (" %08"PRIx32, s->pcs[j]);
+      printf ("\n");
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+
+/* Sampling profiler.
+
+   When the kernel is started with "-prof", every timer tick on
+   every CPU records where the CPU was interrupted: the call stack
+   if it was in the kernel, just the EIP if it was in user mode.
+   Identical samples are counted together.  At shutdown
+   profile_dump() prints the counts for utils/pintos-prof to turn
+   into a flat profile or folded stacks. */
+
+struct intr_frame;
+
+extern bool profile_enabled;
+
+void profile_init (void);
+void profile_sample (const struct intr_frame *);
+void profile_dump (void);
+
+#endif /* threads/profile.h */
@@ -0,0 +1,298 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* An object cache.
+
+   Each slab is one page: a struct slab, then as many objects as
+   fit.  A cache keeps its slabs on three lists, by how many of
+   their objects are in use, and allocates from partially full
+   slabs first so that empty ones can be given back.  One empty
+   slab is kept around, so that a cache whose use goes up and
+   down by one object does not allocate and free a page each
+   time.
+
+   A slab's free objects are linked through a pointer stored at
+   `link_ofs' within each.  Without a constructor that is the
+   start of the object; with one, it is just past the object, so
+   that it does not disturb the constructed state. */
+struct kmem_cache
+  {
+    struct list_elem elem;      /* Element in cache_list. */
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size passed to kmem_cache_create(). */
+    size_t slot_size;           /* Bytes per object in a slab. */
+    size_t link_ofs;            /* Offset of free link in a slot. */
+    size_t first_ofs;           /* Offset of first slot in a slab. */
+    size_t objs_per_slab;       /* Number of slots in a slab. */
+    kmem_ctor *ctor;            /* Constructor, or null. */
+
+    struct lock lock;           /* Protects the following. */
+    struct list full;           /* Slabs with no free objects. */
+    struct list partial;        /* Slabs with some free objects. */
+    struct list empty;          /* Slabs with no objects in use. */
+    size_t slab_cnt;            /* Number of slabs. */
+    size_t in_use;              /* Number of objects allocated. */
+    long long alloc_cnt;        /* Number of kmem_cache_alloc() calls. */
+  };
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Header at the start of each slab page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct kmem_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of cache's lists. */
+    size_t in_use;              /* Number of objects allocated. */
+    void *free;                 /* First free object. */
+  };
+
+/* All caches, for kmem_cache_print_stats().  Protected by
+   disabling interrupts. */
+static struct list cache_list = LIST_INITIALIZER (cache_list);
+
+static struct slab *new_slab (struct kmem_cache *);
+static struct slab *obj_to_slab (void *);
+
+/* Returns the free link within OBJ, in cache C. */
+static inline void **
+obj_link (struct kmem_cache *c, void *obj) 
+{
+  return (void **) ((uint8_t *) obj + c->link_ofs);
+}
+
+/* Creates and returns a cache named NAME for objects of SIZE
+   bytes aligned on ALIGN bytes, which must be a power of 2 or
+   0 for the natural word alignment.  If CTOR is non-null, it is
+   called on every object when its slab is created.  Returns a
+   null pointer if memory is short. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, size_t align,
+                   kmem_ctor *ctor) 
+{
+  struct kmem_cache *c;
+  enum intr_level old_level;
+
+  ASSERT (size > 0);
+  ASSERT ((align & (align - 1)) == 0);
+
+  c = malloc (sizeof *c);
+  if (c == NULL)
+    return NULL;
+
+  if (align < sizeof (void *))
+    align = sizeof (void *);
+  c->name = name;
+  c->obj_size = size;
+  c->ctor = ctor;
+  if (ctor == NULL) 
+    {
+      c->link_ofs = 0;
+      c->slot_size = ROUND_UP (size < sizeof (void *) ? sizeof (void *) : size,
+                               align);
+    }
+  else 
+    {
+      c->link_ofs = ROUND_UP (size, sizeof (void *));
+      c->slot_size = ROUND_UP (c->link_ofs + sizeof (void *), align);
+    }
+  c->first_ofs = ROUND_UP (sizeof (struct slab), align);
+  c->objs_per_slab = (PGSIZE - c->first_ofs) / c->slot_size;
+  ASSERT (c->objs_per_slab >= 2);
+
+  lock_init (&c->lock);
+  list_init (&c->full);
+  list_init (&c->partial);
+  list_init (&c->empty);
+  c->slab_cnt = 0;
+  c->in_use = 0;
+  c->alloc_cnt = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&cache_list, &c->elem);
+  intr_set_level (old_level);
+
+  return c;
+}
+
+/* Destroys cache C, which must have no objects allocated. */
+void
+kmem_cache_destroy (struct kmem_cache *c) 
+{
+  enum intr_level old_level;
+
+  if (c == NULL)
+    return;
+
+  ASSERT (c->in_use == 0);
+  ASSERT (list_empty (&c->full) && list_empty (&c->partial));
+
+  old_level = intr_disable ();
+  list_remove (&c->elem);
+  intr_set_level (old_level);
+
+  while (!list_empty (&c->empty))
+    palloc_free_page (list_entry (list_pop_front (&c->empty),
+                                  struct slab, elem));
+  free (c);
+}
+
+/* Allocates and returns an object from cache C, or a null
+   pointer if memory is short.  If C has a constructor, the
+   object is in its constructed state. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) 
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else if (!list_empty (&c->empty))
+    s = list_entry (list_front (&c->empty), struct slab, elem);
+  else 
+    {
+      s = new_slab (c);
+      if (s == NULL) 
+        {
+          lock_release (&c->lock);
+          return NULL;
+        }
+    }
+
+  /* Take an object, and move S to the list it now belongs on. */
+  obj = s->free;
+  s->free = *obj_link (c, obj);
+  list_remove (&s->elem);
+  if (++s->in_use == c->objs_per_slab)
+    list_push_front (&c->full, &s->elem);
+  else
+    list_push_front (&c->partial, &s->elem);
+  c->in_use++;
+  c->alloc_cnt++;
+  lock_release (&c->lock);
+
+  return obj;
+}
+
+/* Returns OBJ, which must have been allocated from cache C, to
+   C.  If C has a constructor, OBJ must be back in its
+   constructed state.  OBJ may be a null pointer, in which case
+   nothing happens. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) 
+{
+  struct slab *s;
+  struct slab *spare = NULL;
+
+  if (obj == NULL)
+    return;
+
+  s = obj_to_slab (obj);
+  ASSERT (s->cache == c);
+  ASSERT ((size_t) ((uint8_t *) obj - (uint8_t *) s - c->first_ofs)
+          % c->slot_size == 0);
+
+  lock_acquire (&c->lock);
+  ASSERT (s->in_use > 0);
+  *obj_link (c, obj) = s->free;
+  s->free = obj;
+  list_remove (&s->elem);
+  if (--s->in_use > 0)
+    list_push_front (&c->partial, &s->elem);
+  else 
+    {
+      /* Keep one empty slab, and give back any other. */
+      if (!list_empty (&c->empty)) 
+        {
+          spare = s;
+          c->slab_cnt--;
+        }
+      else
+        list_push_front (&c->empty, &s->elem);
+    }
+  c->in_use--;
+  lock_release (&c->lock);
+
+  if (spare != NULL) 
+    {
+      spare->magic = 0;
+      palloc_free_page (spare);
+    }
+}
+
+/* Prints the usage of every cache. */
+void
+kmem_cache_print_stats (void) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&cache_list); e != list_end (&cache_list);
+       e = list_next (e)) 
+    {
+      struct kmem_cache *c = list_entry (e, struct kmem_cache, elem);
+      printf ("Slab: %s: %zu of %zu %zu-byte objects in use in %zu slabs, "
+              "%lld allocations\n",
+              c->name, c->in_use, c->slab_cnt * c->objs_per_slab,
+              c->obj_size, c->slab_cnt, c->alloc_cnt);
+    }
+}
+
+/* Allocates a new slab for cache C, runs C's constructor on its
+   objects, and puts it on C's empty list.  Returns the slab, or
+   a null pointer if memory is short.  C's lock must be held. */
+static struct slab *
+new_slab (struct kmem_cache *c) 
+{
+  struct slab *s;
+  uint8_t *obj;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->in_use = 0;
+  s->free = NULL;
+
+  /* Link the objects in address order, for locality. */
+  obj = (uint8_t *) s + c->first_ofs + c->objs_per_slab * c->slot_size;
+  for (i = 0; i < c->objs_per_slab; i++) 
+    {
+      obj -= c->slot_size;
+      if (c->ctor != NULL)
+        c->ctor (obj);
+      *obj_link (c, obj) = s->free;
+      s->free = obj;
+    }
+
+  list_push_front (&c->empty, &s->elem);
+  c->slab_cnt++;
+  return s;
+}
+
+/* Returns the slab that OBJ is in. */
+static struct slab *
+obj_to_slab (void *obj) 
+{
+  struct slab *s = pg_round_down (obj);
+
+  ASSERT (s != NULL);
+  ASSERT (s->magic == SLAB_MAGIC);
+  return s;
+}
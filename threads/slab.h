@@ -0,0 +1,27 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* Object caches.
+
+   A kmem_cache hands out objects of a single size from page-size
+   "slabs", without rounding the size up to a power of 2 as
+   malloc() does.  Objects of one type end up packed together, and
+   if the cache has a constructor, freed objects keep their
+   constructed state for the next kmem_cache_alloc(). */
+
+struct kmem_cache;
+
+/* Puts a newly allocated object into its constructed state. */
+typedef void kmem_ctor (void *obj);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+                                      size_t align, kmem_ctor *);
+void kmem_cache_destroy (struct kmem_cache *);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *obj);
+
+void kmem_cache_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -0,0 +1,462 @@
+#include "threads/smp.h"
+#include <debug.h>
+#include <packed.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/apic.h"
+#include "devices/timer.h"
+#include "threads/fpu.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/loader.h"
+#include "threads/profile.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/tss.h"
+#endif
+
+/* Symmetric multiprocessing.
+
+   At boot only the bootstrap processor (BSP) runs.  smp_init()
+   finds the other CPUs, the application processors (APs), in the
+   BIOS's MP configuration table and starts each one in
+   ap-start.S, which calls ap_main() on a thread page prepared by
+   thread_init_cpu().  That thread becomes the AP's idle thread.
+
+   All CPUs schedule threads from their own run queues (see
+   thread.c).  Kernel code that disables interrupts stays
+   atomic with respect to the other CPUs because, once
+   smp_enabled is set, intr_disable() also takes a lock shared by
+   all CPUs (see interrupt.c).  Device interrupts, including the
+   timer, go only to the BSP, which forwards each timer tick to
+   the APs as an IPI.
+
+   See [MP] for the MP configuration table and the AP startup
+   protocol. */
+
+/* CPUs.  The first cpu_cnt are online. */
+struct cpu cpus[CPU_MAX];
+unsigned cpu_cnt = 1;
+
+/* True once more than one CPU may be running. */
+bool smp_enabled;
+
+/* MP floating pointer structure.  See [MP] 4.1. */
+struct mp_fp
+  {
+    char signature[4];          /* "_MP_". */
+    uint32_t config;            /* Physical address of config table. */
+    uint8_t length;             /* Length in 16-byte units. */
+    uint8_t spec_rev;           /* MP specification revision. */
+    uint8_t checksum;           /* Makes all the bytes sum to 0. */
+    uint8_t type;               /* Default configuration type, or 0. */
+    uint8_t imcrp;              /* Bit 7 set if the IMCR is present. */
+    uint8_t reserved[3];
+  }
+PACKED;
+
+/* MP configuration table header.  See [MP] 4.2. */
+struct mp_config
+  {
+    char signature[4];          /* "PCMP". */
+    uint16_t length;            /* Length of base table in bytes. */
+    uint8_t version;            /* MP specification revision. */
+    uint8_t checksum;           /* Makes the base table sum to 0. */
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_cnt;         /* Number of entries. */
+    uint32_t lapic_paddr;       /* Physical address of local APICs. */
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+  }
+PACKED;
+
+/* MP configuration table entry types and sizes. */
+#define MP_PROC 0               /* Processor, 20 bytes. */
+#define MP_IOAPIC 2             /* I/O APIC, 8 bytes. */
+
+/* Processor entry. */
+struct mp_proc
+  {
+    uint8_t type;               /* MP_PROC. */
+    uint8_t apic_id;            /* Local APIC ID. */
+    uint8_t apic_version;
+    uint8_t flags;              /* MP_PROC_* flags. */
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+  }
+PACKED;
+#define MP_PROC_ENABLED 0x01    /* Processor usable. */
+#define MP_PROC_BSP 0x02        /* Bootstrap processor. */
+
+/* I/O APIC entry. */
+struct mp_ioapic
+  {
+    uint8_t type;               /* MP_IOAPIC. */
+    uint8_t apic_id;
+    uint8_t version;
+    uint8_t flags;              /* Bit 0 set if usable. */
+    uint32_t paddr;             /* Physical address. */
+  }
+PACKED;
+
+/* Startup code and its parameters, in ap-start.S. */
+extern uint8_t ap_start[], ap_end[];
+extern uint32_t ap_pd, ap_stack, ap_entry;
+
+static size_t mp_probe (unsigned apic_ids[], uintptr_t *lapic_paddr,
+                        uintptr_t *ioapic_paddr, bool *imcrp);
+static struct mp_fp *mp_search (void);
+static struct mp_fp *mp_search_range (uintptr_t paddr, size_t size);
+static uint8_t checksum (const void *, size_t);
+static bool start_ap (unsigned apic_id);
+static void ap_main (void) NO_RETURN;
+static void set_ap_param (uint32_t *param, uint32_t value);
+static intr_handler_func ipi_reschedule, ipi_tlb_flush, ipi_tick;
+
+/* Starts every other CPU described by the MP configuration
+   table.  Must be called by the BSP with interrupts on, after
+   timer calibration and before the first process is created.
+   Does nothing on a uniprocessor. */
+void
+smp_init (void)
+{
+  unsigned apic_ids[CPU_MAX - 1];
+  uintptr_t lapic_paddr, ioapic_paddr;
+  size_t ap_cnt, i;
+  bool imcrp;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  ap_cnt = mp_probe (apic_ids, &lapic_paddr, &ioapic_paddr, &imcrp);
+  if (ap_cnt == 0)
+    return;
+
+  /* If the PICs are wired straight to the BSP, route them
+     through its local APIC instead.  See [MP] 3.6.2.1. */
+  if (imcrp)
+    {
+      outb (0x22, 0x70);
+      outb (0x23, inb (0x23) | 0x01);
+    }
+  apic_init (lapic_paddr, ioapic_paddr);
+  lapic_init (true);
+  cpus[0].apic_id = lapic_id ();
+
+  intr_register_ipi (IPI_RESCHEDULE, ipi_reschedule, "IPI Reschedule");
+  intr_register_ipi (IPI_TLB_FLUSH, ipi_tlb_flush, "IPI TLB Flush");
+  intr_register_ipi (IPI_TICK, ipi_tick, "IPI Timer Tick");
+
+  /* Copy the startup code to where the APs will run it, and map
+     the first 4 MB of physical memory at virtual address 0, so
+     that it keeps running once it turns on paging. */
+  memcpy (ptov (LOADER_AP_BASE), ap_start, ap_end - ap_start);
+  init_page_dir[0] = init_page_dir[pd_no (PHYS_BASE)];
+
+  smp_enabled = true;
+  for (i = 0; i < ap_cnt; i++)
+    if (!start_ap (apic_ids[i]))
+      break;
+
+  /* Remove the low mapping and flush it from our TLB.  The APs
+     flush theirs when they first switch to a user process. */
+  init_page_dir[0] = 0;
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
+
+  printf ("SMP: %u CPUs online.\n", cpu_cnt);
+}
+
+/* Forwards a timer tick to every AP.  Called by the BSP's timer
+   interrupt handler. */
+void
+smp_timer_tick (void)
+{
+  unsigned i;
+
+  for (i = 1; i < cpu_cnt; i++)
+    lapic_send_ipi (cpus[i].apic_id, IPI_TICK);
+}
+
+/* Interrupts CPU C, which must not be the running CPU, so that
+   it picks the best thread from its run queue. */
+void
+smp_reschedule (struct cpu *c)
+{
+  ASSERT (c != cpu_current ());
+  lapic_send_ipi (c->apic_id, IPI_RESCHEDULE);
+}
+
+/* Makes every other CPU that may be using page directory PD
+   flush its TLB, and waits for all of them to do so.  Called
+   after changing a mapping in PD. */
+void
+smp_tlb_shootdown (uint32_t *pd UNUSED)
+{
+#ifdef USERPROG
+  bool pending[CPU_MAX];
+  enum intr_level old_level;
+  struct cpu *self;
+  unsigned i;
+
+  if (cpu_cnt == 1)
+    return;
+
+  /* Interrupts must be off so that no CPU switches threads while
+     we look at what it is running.  A CPU that switches to PD
+     later loads it fresh. */
+  old_level = intr_disable ();
+  self = cpu_current ();
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct cpu *c = &cpus[i];
+
+      pending[i] = c != self && c->current->pagedir == pd;
+      if (pending[i])
+        {
+          c->tlb_flush = true;
+          lapic_send_ipi (c->apic_id, IPI_TLB_FLUSH);
+        }
+    }
+  intr_set_level (old_level);
+
+  /* If our caller has interrupts off, another CPU may be waiting
+     for us to flush while we wait for it, so keep polling. */
+  for (i = 0; i < cpu_cnt; i++)
+    while (pending[i] && cpus[i].tlb_flush)
+      {
+        if (old_level == INTR_OFF)
+          smp_poll ();
+        asm volatile ("pause" : : : "memory");
+      }
+#endif
+}
+
+/* Carries out any TLB shootdown requested of the running CPU.
+   Must be called with interrupts off.  Called from the IPI
+   handler and by code that spins with interrupts off, which
+   would otherwise keep the IPI from being delivered. */
+void
+smp_poll (void)
+{
+  struct cpu *c = cpu_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (c->tlb_flush)
+    {
+      uint32_t cr3;
+
+      /* Reloading CR3 clears the TLB.  See [IA32-v3a] 3.12
+         "Translation Lookaside Buffers (TLBs)". */
+      asm volatile ("movl %%cr3, %0; movl %0, %%cr3"
+                    : "=&r" (cr3) : : "memory");
+      c->tlb_flush = false;
+    }
+}
+
+/* Reads the MP configuration table.  Stores the local APIC IDs
+   of up to CPU_MAX - 1 usable APs in APIC_IDS[] and returns how
+   many there are.  Also stores the physical addresses of the
+   local APICs and the first I/O APIC (or 0) in *LAPIC_PADDR and
+   *IOAPIC_PADDR, and whether the IMCR is present in *IMCRP.
+   Returns 0 if there is no table or it describes only one
+   CPU. */
+static size_t
+mp_probe (unsigned apic_ids[], uintptr_t *lapic_paddr,
+          uintptr_t *ioapic_paddr, bool *imcrp)
+{
+  struct mp_fp *fp;
+  struct mp_config *config;
+  uintptr_t ram_end = init_ram_pages * PGSIZE;
+  size_t ap_cnt = 0;
+  uint8_t *p, *end;
+
+  /* The MP specification also has "default configurations"
+     without a table, for early two-CPU systems.  We don't
+     bother with those. */
+  fp = mp_search ();
+  if (fp == NULL || fp->type != 0 || fp->config == 0
+      || fp->config + sizeof *config > ram_end)
+    return 0;
+
+  config = ptov (fp->config);
+  if (memcmp (config->signature, "PCMP", 4)
+      || fp->config + config->length > ram_end
+      || checksum (config, config->length) != 0)
+    return 0;
+
+  *lapic_paddr = config->lapic_paddr;
+  *ioapic_paddr = 0;
+  *imcrp = (fp->imcrp & 0x80) != 0;
+
+  p = (uint8_t *) (config + 1);
+  end = (uint8_t *) config + config->length;
+  while (p < end)
+    if (*p == MP_PROC)
+      {
+        struct mp_proc *proc = (struct mp_proc *) p;
+        if ((proc->flags & MP_PROC_ENABLED) && !(proc->flags & MP_PROC_BSP)
+            && ap_cnt < CPU_MAX - 1)
+          apic_ids[ap_cnt++] = proc->apic_id;
+        p += sizeof *proc;
+      }
+    else if (*p == MP_IOAPIC)
+      {
+        struct mp_ioapic *ioapic = (struct mp_ioapic *) p;
+        if ((ioapic->flags & 0x01) && *ioapic_paddr == 0)
+          *ioapic_paddr = ioapic->paddr;
+        p += sizeof *ioapic;
+      }
+    else
+      p += 8;
+
+  return ap_cnt;
+}
+
+/* Searches for the MP floating pointer structure where [MP] 4
+   says it may be: in the first kB of the extended BIOS data
+   area, in the last kB of base memory, or in the BIOS ROM.
+   Returns it if found, otherwise a null pointer. */
+static struct mp_fp *
+mp_search (void)
+{
+  uint16_t *bda = ptov (0x400);
+  struct mp_fp *fp;
+  uintptr_t ebda = (uintptr_t) bda[0x0e / 2] << 4;
+  uintptr_t base_end = (uintptr_t) bda[0x13 / 2] * 1024;
+
+  if (ebda != 0 && (fp = mp_search_range (ebda, 1024)) != NULL)
+    return fp;
+  if (base_end >= 1024 && (fp = mp_search_range (base_end - 1024, 1024)))
+    return fp;
+  return mp_search_range (0xf0000, 0x10000);
+}
+
+/* Searches SIZE bytes of physical memory starting at PADDR for
+   the MP floating pointer structure. */
+static struct mp_fp *
+mp_search_range (uintptr_t paddr, size_t size)
+{
+  uint8_t *p, *end;
+
+  if (paddr + size > init_ram_pages * PGSIZE)
+    return NULL;
+
+  end = (uint8_t *) ptov (paddr) + size;
+  for (p = ptov (paddr); p + sizeof (struct mp_fp) <= end; p += 16)
+    if (!memcmp (p, "_MP_", 4) && checksum (p, sizeof (struct mp_fp)) == 0)
+      return (struct mp_fp *) p;
+  return NULL;
+}
+
+/* Returns the sum of the SIZE bytes at BUF, modulo 256. */
+static uint8_t
+checksum (const void *buf_, size_t size)
+{
+  const uint8_t *buf = buf_;
+  uint8_t sum = 0;
+
+  while (size-- > 0)
+    sum += *buf++;
+  return sum;
+}
+
+/* Starts the AP with local APIC ID APIC_ID as cpus[cpu_cnt] and
+   waits for it to come online.  Returns true if successful,
+   false if the AP could not be started. */
+static bool
+start_ap (unsigned apic_id)
+{
+  struct cpu *c = &cpus[cpu_cnt];
+  struct thread *t;
+  int64_t start;
+
+  c->id = cpu_cnt;
+  c->apic_id = apic_id;
+  t = thread_init_cpu (c);
+  if (t == NULL)
+    return false;
+#ifdef USERPROG
+  tss_init_cpu (c);
+  gdt_init_cpu (c);
+#endif
+
+  set_ap_param (&ap_pd, vtop (init_page_dir));
+  set_ap_param (&ap_stack, (uint32_t) t + PGSIZE);
+  set_ap_param (&ap_entry, (uint32_t) ap_main);
+  lapic_start_ap (apic_id, LOADER_AP_BASE);
+
+  /* ap_main() increments cpu_cnt once the AP is online. */
+  start = timer_ticks ();
+  while (cpu_cnt == c->id && timer_elapsed (start) < TIMER_FREQ)
+    barrier ();
+  if (cpu_cnt == c->id)
+    {
+      printf ("SMP: CPU with APIC ID %u did not start.\n", apic_id);
+      return false;
+    }
+  return true;
+}
+
+/* Stores VALUE into PARAM, one of the parameters in ap-start.S,
+   in the copy of that code that the APs run. */
+static void
+set_ap_param (uint32_t *param, uint32_t value)
+{
+  uint8_t *code = ptov (LOADER_AP_BASE);
+  *(uint32_t *) (code + ((uint8_t *) param - ap_start)) = value;
+}
+
+/* C entry point for an AP, called by ap-start.S on the page of
+   the thread that thread_init_cpu() prepared for it. */
+static void
+ap_main (void)
+{
+  intr_init_ap ();
+#ifdef USERPROG
+  gdt_load ();
+#endif
+  lapic_init (false);
+  fpu_init ();
+
+  /* Interrupts have been off since reset, but without this CPU
+     holding the lock that intr_disable() takes.  Turn them on,
+     so that turning them off takes the lock.  No interrupt is
+     sent to us until we are online. */
+  intr_enable ();
+  intr_disable ();
+  cpu_cnt++;
+
+  thread_start_cpu ();
+}
+
+/* IPI handlers. */
+
+static void
+ipi_reschedule (struct intr_frame *f UNUSED)
+{
+  intr_yield_on_return ();
+}
+
+static void
+ipi_tlb_flush (struct intr_frame *f UNUSED)
+{
+  smp_poll ();
+}
+
+static void
+ipi_tick (struct intr_frame *f)
+{
+  profile_sample (f);
+  thread_tick (f);
+}
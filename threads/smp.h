@@ -0,0 +1,67 @@
+#ifndef THREADS_SMP_H
+#define THREADS_SMP_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Maximum number of CPUs we will bring up. */
+#define CPU_MAX 8
+
+/* Interprocessor interrupt vectors. */
+#define IPI_RESCHEDULE 0xf0     /* Check the run queue. */
+#define IPI_TLB_FLUSH 0xf1      /* Reload the page directory. */
+#define IPI_TICK 0xf2           /* Timer tick, forwarded by the BSP. */
+
+/* Per-CPU data.
+
+   Apart from `tlb_flush', the members are only accessed with
+   interrupts off, which on SMP also means under the lock that
+   intr_disable() takes (see interrupt.c). */
+struct cpu
+  {
+    /* Owned by smp.c. */
+    unsigned id;                /* Index in cpus[]; 0 is the BSP. */
+    unsigned apic_id;           /* Local APIC ID. */
+    volatile bool tlb_flush;    /* TLB shootdown pending? */
+
+    /* Owned by thread.c. */
+    struct thread *current;     /* Running thread. */
+    struct thread *idle_thread; /* Runs when ready_list is empty. */
+    struct list ready_list;     /* Ready threads, highest priority first. */
+    unsigned ready_cnt;         /* Number of threads in ready_list. */
+    unsigned thread_ticks;      /* # of timer ticks since last yield. */
+
+    /* Owned by fpu.c. */
+    struct thread *fpu_owner;   /* Thread whose state is in the FPU. */
+
+    /* Owned by interrupt.c. */
+    bool in_external_intr;      /* Processing an external interrupt? */
+    bool yield_on_return;       /* Yield on interrupt return? */
+
+    /* Owned by softirq.c. */
+    bool in_softirq;            /* Running softirqs at interrupt exit? */
+    bool softirq_yield;         /* Yield requested meanwhile? */
+
+#ifdef USERPROG
+    /* Owned by userprog/tss.c. */
+    struct tss *tss;            /* Task-state segment. */
+#endif
+  };
+
+/* CPUs.  The first cpu_cnt are online. */
+extern struct cpu cpus[CPU_MAX];
+extern unsigned cpu_cnt;
+
+/* True once more than one CPU may be running. */
+extern bool smp_enabled;
+
+struct cpu *cpu_current (void);
+
+void smp_init (void);
+void smp_timer_tick (void);
+void smp_reschedule (struct cpu *);
+void smp_tlb_shootdown (uint32_t *pd);
+void smp_poll (void);
+
+#endif /* threads/smp.h */
@@ -0,0 +1,229 @@
+#include "threads/softirq.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/smp.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Maximum number of passes over the pending softirqs at the end
+   of an interrupt before leaving the rest to softirqd. */
+#define SOFTIRQ_PASSES 4
+
+/* Registered softirqs. */
+static softirq_func *handlers[SOFTIRQ_CNT];
+static const char *names[SOFTIRQ_CNT];
+
+/* Bit masks of softirqs raised but not yet run, and of those
+   being run right now.  Protected by disabling interrupts. */
+static uint32_t pending;
+static uint32_t running;
+
+/* Statistics. */
+static long long raise_cnt[SOFTIRQ_CNT];        /* # of raises. */
+static long long intr_run_cnt[SOFTIRQ_CNT];     /* # of runs at intr exit. */
+static long long worker_run_cnt[SOFTIRQ_CNT];   /* # of runs in softirqd. */
+
+/* softirqd, which takes over when there is too much to do at the
+   end of an interrupt. */
+static bool worker_started;
+static bool worker_woken;
+static struct semaphore worker_wakeup;
+
+/* Scheduled tasklets, oldest first.  Protected by disabling
+   interrupts. */
+static struct list tasklets;
+
+static void run_tasklets (void);
+static thread_func worker;
+
+/* Initializes the softirq system.  Must be called before any
+   interrupt handler raises a softirq. */
+void
+softirq_init (void) 
+{
+  list_init (&tasklets);
+  sema_init (&worker_wakeup, 0);
+  softirq_register (SOFTIRQ_TASKLET, run_tasklets, "tasklet");
+}
+
+/* Starts softirqd.  Until this is called, softirqs only run at
+   the end of interrupts. */
+void
+softirq_start (void) 
+{
+  if (thread_create ("softirqd", PRI_MAX, worker, NULL) != TID_ERROR)
+    worker_started = true;
+}
+
+/* Registers HANDLER to run softirq TYPE, which is called NAME for
+   debugging purposes. */
+void
+softirq_register (enum softirq_type type, softirq_func *handler,
+                  const char *name) 
+{
+  ASSERT (type < SOFTIRQ_CNT);
+  ASSERT (handlers[type] == NULL);
+
+  handlers[type] = handler;
+  names[type] = name;
+}
+
+/* Marks softirq TYPE to be run.  May be called from an interrupt
+   handler. */
+void
+softirq_raise (enum softirq_type type) 
+{
+  enum intr_level old_level;
+
+  ASSERT (type < SOFTIRQ_CNT);
+  ASSERT (handlers[type] != NULL);
+
+  old_level = intr_disable ();
+  pending |= 1u << type;
+  raise_cnt[type]++;
+  intr_set_level (old_level);
+}
+
+/* Runs the pending softirqs that are not already running on
+   another CPU, counting each run in CNT.  Returns false if there
+   were none.  Must be called with interrupts off, but turns them
+   on while the handlers run. */
+static bool
+run_pending (long long cnt[SOFTIRQ_CNT]) 
+{
+  uint32_t types = pending & ~running;
+  int type;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (types == 0)
+    return false;
+  pending &= ~types;
+  running |= types;
+
+  intr_enable ();
+  for (type = 0; type < SOFTIRQ_CNT; type++)
+    if (types & (1u << type))
+      handlers[type] ();
+  intr_disable ();
+
+  for (type = 0; type < SOFTIRQ_CNT; type++)
+    if (types & (1u << type))
+      cnt[type]++;
+  running &= ~types;
+  return true;
+}
+
+/* Called by intr_handler() at the end of an external interrupt,
+   after the EOI, with interrupts off.  Runs pending softirqs
+   with interrupts on, unless this interrupt arrived while this
+   CPU was already doing so, and wakes softirqd if work is still
+   left after SOFTIRQ_PASSES passes.  Returns true if a handler
+   asked for the interrupted thread to yield. */
+bool
+softirq_intr_exit (void) 
+{
+  struct cpu *c = cpu_current ();
+  bool yield;
+  int pass;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!intr_context ());
+
+  if ((pending & ~running) == 0 || c->in_softirq)
+    return false;
+
+  /* While IN_SOFTIRQ is set, thread_yield() only records the
+     request, so we stay on this CPU and in this thread. */
+  c->in_softirq = true;
+  for (pass = 0; pass < SOFTIRQ_PASSES; pass++)
+    if (!run_pending (intr_run_cnt))
+      break;
+  c->in_softirq = false;
+
+  if (pending != 0 && worker_started && !worker_woken) 
+    {
+      worker_woken = true;
+      sema_up (&worker_wakeup);
+    }
+
+  yield = c->softirq_yield;
+  c->softirq_yield = false;
+  return yield;
+}
+
+/* softirqd's body. */
+static void
+worker (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      enum intr_level old_level;
+
+      sema_down (&worker_wakeup);
+      old_level = intr_disable ();
+      worker_woken = false;
+      while (run_pending (worker_run_cnt))
+        continue;
+      intr_set_level (old_level);
+    }
+}
+
+/* Prints softirq statistics. */
+void
+softirq_print_stats (void) 
+{
+  int type;
+
+  for (type = 0; type < SOFTIRQ_CNT; type++)
+    if (handlers[type] != NULL)
+      printf ("Softirq: %s raised %lld times, ran %lld at interrupt exit, "
+              "%lld in softirqd\n", names[type], raise_cnt[type],
+              intr_run_cnt[type], worker_run_cnt[type]);
+}
+
+/* Initializes tasklet T to call FUNC, passing AUX. */
+void
+tasklet_init (struct tasklet *t, tasklet_func *func, void *aux) 
+{
+  ASSERT (t != NULL);
+  ASSERT (func != NULL);
+
+  t->func = func;
+  t->aux = aux;
+  t->scheduled = false;
+}
+
+/* Schedules tasklet T to run once, soon.  May be called from an
+   interrupt handler. */
+void
+tasklet_schedule (struct tasklet *t) 
+{
+  enum intr_level old_level = intr_disable ();
+  if (!t->scheduled) 
+    {
+      t->scheduled = true;
+      list_push_back (&tasklets, &t->elem);
+      softirq_raise (SOFTIRQ_TASKLET);
+    }
+  intr_set_level (old_level);
+}
+
+/* SOFTIRQ_TASKLET handler. */
+static void
+run_tasklets (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  while (!list_empty (&tasklets)) 
+    {
+      struct tasklet *t = list_entry (list_pop_front (&tasklets),
+                                      struct tasklet, elem);
+      t->scheduled = false;
+      intr_set_level (old_level);
+      t->func (t->aux);
+      old_level = intr_disable ();
+    }
+  intr_set_level (old_level);
+}
@@ -0,0 +1,54 @@
+#ifndef THREADS_SOFTIRQ_H
+#define THREADS_SOFTIRQ_H
+
+#include <list.h>
+#include <stdbool.h>
+
+/* Deferred interrupt work ("softirqs").
+
+   An external interrupt handler should do only what must happen
+   with interrupts off, such as talking to the device, and raise
+   a softirq for the rest.  Raised softirqs run when intr_handler()
+   finishes the interrupt, after the EOI and with interrupts back
+   on.  If they keep getting raised again, the rest is left to
+   the "softirqd" kernel thread, which runs at PRI_MAX.
+
+   A softirq handler runs on the stack of whatever thread was
+   interrupted, so it must not sleep.  A yield that it causes,
+   e.g. by waking a higher priority thread, is put off until it
+   returns.  A given softirq never runs on two CPUs at once. */
+
+/* Softirq types, in the order they run. */
+enum softirq_type
+  {
+    SOFTIRQ_TIMER,              /* Timer tick bookkeeping. */
+    SOFTIRQ_TASKLET,            /* Runs scheduled tasklets. */
+    SOFTIRQ_CNT                 /* Number of softirq types. */
+  };
+
+typedef void softirq_func (void);
+
+void softirq_init (void);
+void softirq_start (void);
+void softirq_register (enum softirq_type, softirq_func *, const char *name);
+void softirq_raise (enum softirq_type);
+bool softirq_intr_exit (void);
+void softirq_print_stats (void);
+
+/* A tasklet: a function call that an interrupt handler asks to
+   have made later, from SOFTIRQ_TASKLET.  Scheduling a tasklet
+   that is already scheduled has no effect. */
+typedef void tasklet_func (void *aux);
+
+struct tasklet
+  {
+    struct list_elem elem;      /* Element in list of scheduled tasklets. */
+    tasklet_func *func;         /* Function to call. */
+    void *aux;                  /* Argument to pass. */
+    bool scheduled;             /* In the list? */
+  };
+
+void tasklet_init (struct tasklet *, tasklet_func *, void *aux);
+void tasklet_schedule (struct tasklet *);
+
+#endif /* threads/softirq.h */
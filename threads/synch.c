@@ -30,7 +30,57 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
+#ifdef LOCK_PROFILE
+#include <inttypes.h>
+#include "devices/timer.h"
+#endif
+
+/* Maximum length of a chain of locks that priority is donated
+   through.  Bounds the work done in lock_acquire() and keeps a
+   lock cycle (a deadlock) from looping forever. */
+#define DONATION_DEPTH_MAX 8
+
+/* Maximum number of times an adaptive lock waiter spins or
+   yields waiting for a running or ready holder before it gives
+   up and blocks. */
+#define ADAPTIVE_SPIN_MAX 16
+
+/* Adaptive lock statistics. */
+static long long adaptive_acquires;  /* # of acquisitions. */
+static long long adaptive_contended; /* # that found the lock held. */
+static long long adaptive_spun;      /* # of those that avoided blocking. */
+static long long adaptive_yields;    /* # of yields while waiting. */
+
+#ifdef LOCK_PROFILE
+/* Contention statistics shared by every lock or semaphore
+   initialized from one call site. */
+struct lock_class
+  {
+    void *site;                 /* Caller of lock_init() or sema_init(). */
+    bool is_lock;               /* Lock or bare semaphore? */
+    long long acquires;         /* # of acquisitions or downs. */
+    long long contended;        /* # of those that had to wait. */
+    int64_t wait_ticks;         /* Total timer ticks spent waiting. */
+    int64_t max_hold_ticks;     /* Longest a lock was held, in ticks. */
+  };
+
+/* Table of lock classes.  Classes are never freed, so locks
+   embedded in freed objects (e.g. struct thread) remain safe to
+   report on.  Sites beyond the table's capacity share the last
+   entry, which has a null site. */
+#define LOCK_CLASS_CNT 128
+static struct lock_class lock_classes[LOCK_CLASS_CNT];
+static size_t lock_class_cnt;
+
+static struct lock_class *lock_class_lookup (void *site, bool is_lock);
+#endif
+
+static void sema_init_at (struct semaphore *, unsigned value,
+                          void *site, bool is_lock);
+static void lock_init_at (struct lock *, void *site);
 
 /* Returns true if value A->priority is greater than value B->priority. */
 static bool
@@ -43,6 +93,18 @@ cmp_priority (const struct list_elem *a_, const struct list_elem *b_,
   return a->priority > b->priority;
 }
 
+/* Returns true if value A->priority is less than value B->priority.
+   For use with list_max(). */
+static bool
+cmp_priority_less (const struct list_elem *a_, const struct list_elem *b_,
+                   void *aux UNUSED) 
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+  
+  return a->priority < b->priority;
+}
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -54,11 +116,24 @@ cmp_priority (const struct list_elem *a_, const struct list_elem *b_,
      thread, if any). */
 void
 sema_init (struct semaphore *sema, unsigned value) 
+{
+  sema_init_at (sema, value, __builtin_return_address (0), false);
+}
+
+/* Initializes SEMA to VALUE on behalf of the code at SITE, for
+   profiling purposes.  IS_LOCK is true if SEMA is part of a
+   lock. */
+static void
+sema_init_at (struct semaphore *sema, unsigned value,
+              void *site UNUSED, bool is_lock UNUSED) 
 {
   ASSERT (sema != NULL);
 
   sema->value = value;
   list_init (&sema->waiters);
+#ifdef LOCK_PROFILE
+  sema->class = lock_class_lookup (site, is_lock);
+#endif
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -77,12 +152,24 @@ sema_down (struct semaphore *sema)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
+#ifdef LOCK_PROFILE
+  bool contended = sema->value == 0;
+  int64_t start = contended ? timer_ticks () : 0;
+#endif
   while (sema->value == 0) 
     {
       // list_push_back (&sema->waiters, &thread_current ()->elem);
       list_insert_ordered(&sema->waiters, &thread_current()->elem, &cmp_priority, NULL);
       thread_block ();
     }
+#ifdef LOCK_PROFILE
+  sema->class->acquires++;
+  if (contended) 
+    {
+      sema->class->contended++;
+      sema->class->wait_ticks += timer_elapsed (start);
+    }
+#endif
   sema->value--;
   intr_set_level (old_level);
 }
@@ -105,6 +192,9 @@ sema_try_down (struct semaphore *sema)
     {
       sema->value--;
       success = true; 
+#ifdef LOCK_PROFILE
+      sema->class->acquires++;
+#endif
     }
   else
     success = false;
@@ -125,12 +215,16 @@ sema_up (struct semaphore *sema)
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters)){ 
-     /*Ensure that the list is always sorted: priority-donation-lowering*/
-     list_sort(&sema->waiters, &cmp_priority, NULL);
-     thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
-  }
+  if (!list_empty (&sema->waiters)) 
+    {
+      /* Waiters' priorities may have been raised by donation after
+         they were queued, so pick the maximum rather than the
+         front. */
+      struct list_elem *e = list_max (&sema->waiters, cmp_priority_less,
+                                      NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
 }
@@ -189,17 +283,150 @@ sema_test_helper (void *sema_)
    instead of a lock. */
 void
 lock_init (struct lock *lock)
+{
+  lock_init_at (lock, __builtin_return_address (0));
+}
+
+/* Initializes LOCK on behalf of the code at SITE, for profiling
+   purposes. */
+static void
+lock_init_at (struct lock *lock, void *site) 
 {
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
-  sema_init (&lock->semaphore, 1);
+  lock->max_priority = PRI_MIN;
+  lock->adaptive = false;
+  sema_init_at (&lock->semaphore, 1, site, true);
+}
+
+/* Initializes LOCK as an adaptive lock.  An adaptive lock
+   behaves like any other lock, except that a thread that finds
+   it held first waits a little while for the holder to finish,
+   instead of going straight onto the semaphore's waiters list.
+   While the holder is running on another CPU we spin; while it
+   is ready to run and not outranked by us we yield to it.  If
+   the holder is blocked, or the lock is still held after
+   ADAPTIVE_SPIN_MAX rounds, we block as usual (donating our
+   priority).
+
+   This pays off for locks that are only held across short
+   critical sections, such as the page allocator's pool locks
+   and malloc()'s descriptor locks. */
+void
+lock_init_adaptive (struct lock *lock)
+{
+  lock_init_at (lock, __builtin_return_address (0));
+  lock->adaptive = true;
+}
+
+/* Waits briefly for the holder of adaptive LOCK to release it,
+   as described at lock_init_adaptive().  Returns true if LOCK
+   was seen free, false if the caller should block.  Must be
+   called with interrupts off. */
+static bool
+lock_spin (struct lock *lock) 
+{
+  struct thread *cur = thread_current ();
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (i = 0; i < ADAPTIVE_SPIN_MAX; i++)
+    {
+      struct thread *holder = lock->holder;
+
+      if (holder == NULL)
+        return true;
+      else if (holder->status == THREAD_RUNNING)
+        {
+          /* Only possible with more than one CPU. */
+          intr_enable ();
+          asm volatile ("pause" : : : "memory");
+          intr_disable ();
+        }
+      else if (holder->status == THREAD_READY
+               && holder->priority >= cur->priority)
+        {
+          adaptive_yields++;
+          thread_yield ();
+        }
+      else
+        return false;
+    }
+  return lock->holder == NULL;
+}
+
+/* Donates the running thread's priority along the chain of locks
+   starting at LOCK: each lock's holder is raised to at least our
+   priority, and if that holder is itself waiting on a lock, the
+   donation continues through it, up to DONATION_DEPTH_MAX
+   levels.
+
+   Must be called with interrupts off. */
+static void
+donate_priority (struct lock *lock) 
+{
+  int priority = thread_current ()->priority;
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (depth = 0; lock != NULL && depth < DONATION_DEPTH_MAX; depth++)
+    {
+      struct thread *holder = lock->holder;
+
+      if (holder == NULL || lock->max_priority >= priority)
+        break;
+      lock->max_priority = priority;
+      thread_update_priority (holder);
+      lock = holder->waiting_lock;
+    }
+}
+
+/* Recomputes LOCK's max_priority from the threads still waiting
+   on it.  Must be called with interrupts off. */
+static void
+lock_update_max_priority (struct lock *lock) 
+{
+  struct list *waiters = &lock->semaphore.waiters;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (list_empty (waiters))
+    lock->max_priority = PRI_MIN;
+  else
+    lock->max_priority = list_entry (list_max (waiters, cmp_priority_less,
+                                               NULL),
+                                     struct thread, elem)->priority;
+}
+
+/* Records that the running thread now holds LOCK.
+   Must be called with interrupts off. */
+static void
+lock_take (struct lock *lock) 
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  lock->holder = cur;
+#ifdef LOCK_PROFILE
+  lock->acquire_time = timer_ticks ();
+#endif
+  lock_update_max_priority (lock);
+  list_push_back (&cur->held_locks, &lock->elem);
+  thread_update_priority (cur);
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While we wait, our priority is donated to the holder and, if
+   the holder is itself blocked on a lock, onward along that chain
+   (see donate_priority()).
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -207,24 +434,36 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
-  enum intr_level old_int_level = intr_disable();
-
-  /* Check whether a given thread has acquired the lock */
-  if(lock->semaphore.value <= 0){
-    if(lock->holder->priority < thread_get_priority()){
-      list_insert_ordered(&lock->holder->donate_list, &thread_current()->donate_elem, &cmp_priority, NULL);
-      lock->holder->priority = thread_get_priority();
+  old_level = intr_disable ();
+  if (lock->adaptive)
+    {
+      adaptive_acquires++;
+      if (lock->holder != NULL)
+        {
+          adaptive_contended++;
+          if (lock_spin (lock))
+            adaptive_spun++;
+        }
+    }
+  if (lock->holder != NULL)
+    {
+      TRACE (TRACE_LOCK_WAIT, lock, lock->holder->tid);
+      cur->waiting_lock = lock;
+      donate_priority (lock);
     }
-  }
-
-  intr_set_level(old_int_level);
-
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  if (cur->waiting_lock != NULL)
+    TRACE (TRACE_LOCK_ACQUIRED, lock, 0);
+  cur->waiting_lock = NULL;
+  lock_take (lock);
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -238,12 +477,17 @@ lock_try_acquire (struct lock *lock)
 {
   bool success;
 
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (!lock_held_by_current_thread (lock));
+
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
-  if (success){
-    lock->holder = thread_current ();
-  }
+  if (success)
+    lock_take (lock);
+  intr_set_level (old_level);
+
   return success;
 }
 
@@ -255,41 +499,32 @@ lock_try_acquire (struct lock *lock)
 void
 lock_release (struct lock *lock) 
 {
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
-  struct thread *cur = thread_current();
-  struct thread *t = NULL;
-  enum intr_level old_int_level = intr_disable();
-
-  /* Only enter the condition if it's not a console call */
-  if(thread_current()->acquired_by_console == 0){
-      cur->released = true;
-    /* Check whether there's anything on our donating list */
-    if(!list_empty(&lock->holder->donate_list)){ 
-      /* Pop and store the first element in our list */
-      t = list_entry(list_pop_front(&(lock->holder->donate_list)), struct thread, donate_elem);
-      if(!list_empty(&lock->holder->donate_list)){
-        thread_set_priority(list_entry(list_begin(&(lock->holder->donate_list)), struct thread, donate_elem)->priority);
-      }
-      else{
-        t->priority_old_release = true;
-        thread_set_priority(cur->priority_old);
-      }
-    }
-  }
-
 
-  intr_set_level(old_int_level);
+  /* Drop the donations that came in through LOCK. */
+  old_level = intr_disable ();
+#ifdef LOCK_PROFILE
+  {
+    struct lock_class *class = lock->semaphore.class;
+    int64_t held = timer_elapsed (lock->acquire_time);
+    if (held > class->max_hold_ticks)
+      class->max_hold_ticks = held;
+  }
+#endif
+  list_remove (&lock->elem);
+  lock->max_priority = PRI_MIN;
+  thread_update_priority (cur);
 
   lock->holder = NULL;
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
 
-  /* Yield and schedule the thread again */
-  if((t != NULL) && (t->priority > thread_get_priority()) && cur->acquired_by_console == 0){
-    thread_yield();
-  }
-  /* Reset this value for console lock calls */
-  cur->acquired_by_console = 0;
+  if (!intr_context ())
+    thread_yield_to_higher ();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -303,6 +538,309 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+/* Initializes RWLOCK.  A reader-writer lock may be held in
+   shared mode by any number of readers at once, or in exclusive
+   mode by a single writer.
+
+   When the lock becomes free, it is handed to the
+   highest-priority waiter: if that is a writer, the writer gets
+   exclusive access; otherwise every waiting reader that outranks
+   the best waiting writer is admitted together.  If
+   PREFER_WRITERS is true, waiting writers are always served
+   before waiting readers, and new readers queue up behind a
+   waiting writer instead of joining the current readers, so a
+   steady stream of readers cannot starve writers.
+
+   Like locks, reader-writer locks are not recursive, and a
+   thread must release the lock in the same mode it acquired it.
+   Unlike locks, they do not donate priority. */
+void
+rwlock_init (struct rwlock *rw, bool prefer_writers) 
+{
+  ASSERT (rw != NULL);
+
+  rw->readers = 0;
+  rw->writer = NULL;
+  list_init (&rw->read_waiters);
+  list_init (&rw->write_waiters);
+  rw->prefer_writers = prefer_writers;
+}
+
+/* Returns the highest-priority thread in WAITERS, or a null
+   pointer if WAITERS is empty. */
+static struct thread *
+rwlock_top_waiter (struct list *waiters) 
+{
+  if (list_empty (waiters))
+    return NULL;
+  return list_entry (list_max (waiters, cmp_priority_less, NULL),
+                     struct thread, elem);
+}
+
+/* Returns true if the running thread may take RW for reading
+   without waiting.  Must be called with interrupts off. */
+static bool
+rwlock_can_read (struct rwlock *rw) 
+{
+  struct thread *w;
+
+  if (rw->writer != NULL)
+    return false;
+
+  /* Don't let a new reader jump ahead of a writer that would be
+     served first when the current readers drain. */
+  w = rwlock_top_waiter (&rw->write_waiters);
+  return (w == NULL
+          || (!rw->prefer_writers
+              && thread_current ()->priority > w->priority));
+}
+
+/* Hands RW, which must be free, to the waiters that should run
+   next, as described at rwlock_init().  Returns true if any
+   thread was woken.  Must be called with interrupts off. */
+static bool
+rwlock_grant (struct rwlock *rw) 
+{
+  struct thread *w, *r;
+  struct list_elem *e, *next;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (rw->readers == 0 && rw->writer == NULL);
+
+  w = rwlock_top_waiter (&rw->write_waiters);
+  r = rwlock_top_waiter (&rw->read_waiters);
+  if (w == NULL && r == NULL)
+    return false;
+
+  if (w != NULL && (rw->prefer_writers || r == NULL
+                    || w->priority >= r->priority))
+    {
+      list_remove (&w->elem);
+      rw->writer = w;
+      thread_unblock (w);
+      return true;
+    }
+
+  for (e = list_begin (&rw->read_waiters); e != list_end (&rw->read_waiters);
+       e = next)
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+
+      next = list_next (e);
+      if (w == NULL || t->priority > w->priority)
+        {
+          list_remove (e);
+          rw->readers++;
+          thread_unblock (t);
+        }
+    }
+  return true;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds or is
+   entitled to it.  Ownership is handed over directly by the
+   releasing thread, so there is no need to recheck after
+   waking.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != thread_current ());
+
+  old_level = intr_disable ();
+  if (rwlock_can_read (rw))
+    rw->readers++;
+  else
+    {
+      list_insert_ordered (&rw->read_waiters, &thread_current ()->elem,
+                           cmp_priority, NULL);
+      thread_block ();
+    }
+  intr_set_level (old_level);
+}
+
+/* Tries to acquire RW for reading without sleeping.  Returns
+   true if successful, false otherwise. */
+bool
+rwlock_try_acquire_read (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  success = rwlock_can_read (rw);
+  if (success)
+    rw->readers++;
+  intr_set_level (old_level);
+
+  return success;
+}
+
+/* Releases RW, which the running thread must hold for reading.
+   The last reader out hands the lock to the next waiters. */
+void
+rwlock_release_read (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+  bool woke = false;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->readers > 0);
+
+  old_level = intr_disable ();
+  if (--rw->readers == 0)
+    woke = rwlock_grant (rw);
+  intr_set_level (old_level);
+
+  if (woke && !intr_context ())
+    thread_yield_to_higher ();
+}
+
+/* Acquires RW for writing, sleeping until all readers and any
+   other writer have released it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (rw->writer != cur);
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && rw->readers == 0)
+    rw->writer = cur;
+  else
+    {
+      list_insert_ordered (&rw->write_waiters, &cur->elem,
+                           cmp_priority, NULL);
+      thread_block ();
+    }
+  ASSERT (rw->writer == cur);
+  intr_set_level (old_level);
+}
+
+/* Tries to acquire RW for writing without sleeping.  Returns
+   true if successful, false otherwise. */
+bool
+rwlock_try_acquire_write (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+  bool success;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  success = rw->writer == NULL && rw->readers == 0;
+  if (success)
+    rw->writer = thread_current ();
+  intr_set_level (old_level);
+
+  return success;
+}
+
+/* Releases RW, which the running thread must hold for writing,
+   and hands it to the next waiters. */
+void
+rwlock_release_write (struct rwlock *rw) 
+{
+  enum intr_level old_level;
+  bool woke;
+
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_for_write (rw));
+
+  old_level = intr_disable ();
+  rw->writer = NULL;
+  woke = rwlock_grant (rw);
+  intr_set_level (old_level);
+
+  if (woke && !intr_context ())
+    thread_yield_to_higher ();
+}
+
+/* Returns true if the running thread holds RW for writing. */
+bool
+rwlock_held_for_write (const struct rwlock *rw) 
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/* Prints adaptive lock statistics and, if LOCK_PROFILE is
+   defined, per-site contention statistics.  Sites are printed as
+   code addresses; pass them to the `backtrace' utility to
+   translate them into function names and line numbers. */
+void
+lock_print_stats (void) 
+{
+  printf ("Locks: %lld adaptive acquisitions, %lld contended, "
+          "%lld without blocking, %lld yields\n",
+          adaptive_acquires, adaptive_contended, adaptive_spun,
+          adaptive_yields);
+#ifdef LOCK_PROFILE
+  {
+    size_t i;
+
+    printf ("Lock profile (site, kind, acquires, contended, "
+            "wait ticks, max hold ticks):\n");
+    for (i = 0; i < lock_class_cnt; i++) 
+      {
+        const struct lock_class *c = &lock_classes[i];
+        if (c->acquires == 0)
+          continue;
+        printf (" %10p %-4s %8lld %8lld %8"PRId64" %8"PRId64"\n",
+                c->site, c->is_lock ? "lock" : "sema", c->acquires,
+                c->contended, c->wait_ticks, c->max_hold_ticks);
+      }
+  }
+#endif
+}
+
+#ifdef LOCK_PROFILE
+/* Returns the lock class for locks or semaphores initialized at
+   SITE, creating it if necessary. */
+static struct lock_class *
+lock_class_lookup (void *site, bool is_lock) 
+{
+  struct lock_class *c;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  for (c = lock_classes; c < lock_classes + lock_class_cnt; c++)
+    if (c->site == site && c->is_lock == is_lock)
+      goto done;
+  if (lock_class_cnt < LOCK_CLASS_CNT - 1)
+    {
+      c = &lock_classes[lock_class_cnt++];
+      c->site = site;
+      c->is_lock = is_lock;
+    }
+  else
+    {
+      /* Out of classes: lump the rest together. */
+      c = &lock_classes[LOCK_CLASS_CNT - 1];
+      lock_class_cnt = LOCK_CLASS_CNT;
+    }
+ done:
+  intr_set_level (old_level);
+  return c;
+}
+#endif
+
 /* One semaphore in a list. */
 struct semaphore_elem 
   {
@@ -392,4 +930,66 @@ cond_broadcast (struct condition *cond, struct lock *lock)
 
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
-}
\ No newline at end of file
+}
+
+/* Initializes spin lock SL as unheld. */
+void
+spinlock_init (struct spinlock *sl) 
+{
+  ASSERT (sl != NULL);
+
+  sl->locked = 0;
+  sl->cpu = NULL;
+}
+
+/* Acquires SL, spinning until it is available.  SL must not
+   already be held by the running CPU.  Must be called with
+   interrupts off. */
+void
+spinlock_acquire (struct spinlock *sl) 
+{
+  while (!spinlock_try_acquire (sl))
+    while (sl->locked)
+      asm volatile ("pause" : : : "memory");
+}
+
+/* Tries to acquire SL and returns true if successful or false
+   on failure.  Must be called with interrupts off. */
+bool
+spinlock_try_acquire (struct spinlock *sl) 
+{
+  uint32_t old = 1;
+
+  ASSERT (sl != NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* XCHG with a memory operand is always atomic and is a full
+     memory barrier.  See [IA32-v2b] "XCHG". */
+  asm volatile ("xchgl %0, %1" : "+r" (old), "+m" (sl->locked) : : "memory");
+  if (old != 0)
+    return false;
+  sl->cpu = cpu_current ();
+  return true;
+}
+
+/* Releases SL, which must be held by the running CPU. */
+void
+spinlock_release (struct spinlock *sl) 
+{
+  ASSERT (spinlock_held (sl));
+
+  sl->cpu = NULL;
+  barrier ();
+  sl->locked = 0;
+}
+
+/* Returns true if the running CPU holds SL, false otherwise.
+   Must be called with interrupts off, or the answer could be
+   stale by the time it is used. */
+bool
+spinlock_held (const struct spinlock *sl) 
+{
+  ASSERT (sl != NULL);
+
+  return sl->locked && sl->cpu == cpu_current ();
+}
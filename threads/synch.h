@@ -3,12 +3,24 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+/* Define LOCK_PROFILE (e.g. add -DLOCK_PROFILE to DEFINES in a
+   Make.vars file) to collect contention statistics for locks and
+   semaphores, grouped by the call site that initialized them.
+   lock_print_stats() prints them. */
+#ifdef LOCK_PROFILE
+struct lock_class;
+#endif
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
     struct list waiters;        /* List of waiting threads. */
+#ifdef LOCK_PROFILE
+    struct lock_class *class;   /* Statistics for this init site. */
+#endif
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -22,13 +34,41 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    int max_priority;           /* Highest priority among waiters. */
+    struct list_elem elem;      /* Element in holder's held_locks. */
+    bool adaptive;              /* Spin or yield before blocking? */
+#ifdef LOCK_PROFILE
+    int64_t acquire_time;       /* Timer tick when last acquired. */
+#endif
   };
 
 void lock_init (struct lock *);
+void lock_init_adaptive (struct lock *);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+void lock_print_stats (void);
+
+/* Reader-writer lock.  Any number of readers may hold it at
+   once, or a single writer. */
+struct rwlock 
+  {
+    unsigned readers;           /* Number of readers holding the lock. */
+    struct thread *writer;      /* Writer holding the lock, if any. */
+    struct list read_waiters;   /* Threads waiting to read. */
+    struct list write_waiters;  /* Threads waiting to write. */
+    bool prefer_writers;        /* Waiting writers block new readers. */
+  };
+
+void rwlock_init (struct rwlock *, bool prefer_writers);
+void rwlock_acquire_read (struct rwlock *);
+bool rwlock_try_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+bool rwlock_try_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
 
 /* Condition variable. */
 struct condition 
@@ -41,6 +81,22 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Spin lock, for mutual exclusion between CPUs in code that
+   cannot sleep.  It is held by a CPU, not a thread, and only
+   with interrupts off, which also keeps interrupt handlers on
+   the holding CPU out. */
+struct spinlock
+  {
+    volatile uint32_t locked;   /* Nonzero while held. */
+    struct cpu *cpu;            /* Holder, for debugging. */
+  };
+
+void spinlock_init (struct spinlock *);
+void spinlock_acquire (struct spinlock *);
+bool spinlock_try_acquire (struct spinlock *);
+void spinlock_release (struct spinlock *);
+bool spinlock_held (const struct spinlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
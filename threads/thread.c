@@ -5,12 +5,19 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/softirq.h"
+#include "threads/smp.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
+#include "threads/trace.h"
+#include "threads/tsc.h"
 #include "threads/vaddr.h"
+#include "threads/workqueue.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -20,12 +27,25 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-
-/* Idle thread. */
-static struct thread *idle_thread;
+/* Each CPU has its own list of processes in THREAD_READY state,
+   that is, processes that are ready to run but not actually
+   running, and its own idle thread.  See struct cpu in smp.h. */
+
+/* Pages of threads that have exited, kept for thread_create() to
+   reuse without going to the page allocator or zeroing the whole
+   page.  Up to THREAD_CACHE_MAX pages are cached; beyond that,
+   pages wait on reap_list until REAP_BATCH of them can be
+   returned to the page allocator at once, by reap_work on
+   system_wq or, before that is running, by thread_create().
+   Pages are linked through their struct thread's `elem'.  Both
+   lists are protected by disabling interrupts. */
+#define THREAD_CACHE_MAX 16
+#define REAP_BATCH 8
+static struct list thread_cache;
+static size_t thread_cache_cnt;
+static struct list reap_list;
+static size_t reap_cnt;
+static struct work reap_work;
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
@@ -43,27 +63,57 @@ struct kernel_thread_frame
 
 /* Statistics. */
 static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
+static long long kernel_ticks;  /* # of timer ticks in the kernel. */
+static long long user_ticks;    /* # of timer ticks in user mode. */
+static long long steal_cnt;     /* # of threads taken by idle CPUs. */
+static long long balance_cnt;   /* # of threads moved by rebalancing. */
+static long long voluntary_switches;    /* # of switches to block or yield. */
+static long long involuntary_switches;  /* # of preemptions. */
+static uint64_t ready_cycles;   /* TSC cycles threads spent ready. */
+
+/* Wakeup latency, the TSC cycles from thread_unblock() until the
+   thread runs, as a histogram over all threads.  Bucket 0 counts
+   latencies under 2**LATENCY_SHIFT cycles, bucket N > 0 those in
+   [2**(LATENCY_SHIFT+N-1), 2**(LATENCY_SHIFT+N)), except that the
+   last bucket also counts everything longer. */
+#define LATENCY_SHIFT 10
+static unsigned wakeup_latency[LATENCY_BUCKETS];
 
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+#define BALANCE_INTERVAL 16     /* # of timer ticks between rebalances. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* If true, print each thread's scheduling statistics when it
+   exits.  Controlled by kernel command-line option
+   "-thread-stats". */
+bool thread_report_stats;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
-static struct thread *next_thread_to_run (void);
+static struct thread *next_thread_to_run (struct cpu *);
+static struct cpu *choose_cpu (struct thread *, struct cpu *preferred);
+static void ready_push (struct cpu *, struct thread *);
+static void ready_remove (struct thread *);
+static struct thread *steal_thread (struct cpu *);
+static void balance (struct cpu *);
+static void print_thread_stats (struct thread *, void *aux);
+static void print_latency (const char *prefix,
+                           const unsigned hist[LATENCY_BUCKETS]);
 static void init_thread (struct thread *, const char *name, int priority);
+static struct thread *alloc_thread (void);
+static void free_thread (struct thread *);
+static work_func reap_thread_pages;
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
-static void schedule (void);
+static void schedule (struct cpu *);
+static void yield (bool preempted);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
 
@@ -80,6 +130,14 @@ cmp_priority (const struct list_elem *a_, const struct list_elem *b_,
   return a->priority > b->priority;
 }
 
+/* Returns true if thread T's affinity mask allows it to run on
+   CPU C. */
+static bool
+cpu_allowed (const struct thread *t, const struct cpu *c) 
+{
+  return (t->affinity & (1u << c->id)) != 0;
+}
+
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -97,19 +155,60 @@ cmp_priority (const struct list_elem *a_, const struct list_elem *b_,
 void
 thread_init (void) 
 {
+  struct cpu *bsp = &cpus[0];
+
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
+  list_init (&bsp->ready_list);
   list_init (&all_list);
   list_init (&waiting_list);
+  list_init (&thread_cache);
+  list_init (&reap_list);
+  work_init (&reap_work, reap_thread_pages, NULL);
 
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
+  initial_thread->cpu = bsp;
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
+  bsp->current = initial_thread;
+}
+
+/* Prepares the thread that CPU C will start up in, which then
+   becomes C's idle thread, and initializes C's run queue.
+   Returns the thread, or a null pointer if memory is short. */
+struct thread *
+thread_init_cpu (struct cpu *c) 
+{
+  struct thread *t;
+  char name[16];
+
+  t = palloc_get_page (PAL_ZERO);
+  if (t == NULL)
+    return NULL;
+
+  snprintf (name, sizeof name, "idle%u", c->id);
+  init_thread (t, name, PRI_MIN);
+  t->tid = allocate_tid ();
+  t->cpu = c;
+  t->affinity = 1u << c->id;
+  t->status = THREAD_RUNNING;
+
+  list_init (&c->ready_list);
+  c->idle_thread = c->current = t;
+  return t;
+}
+
+/* Runs the idle loop on a CPU that has just come online, in the
+   thread that thread_init_cpu() prepared for it. */
+void
+thread_start_cpu (void) 
+{
+  idle (NULL);
+  NOT_REACHED ();
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -129,26 +228,37 @@ thread_start (void)
   sema_down (&idle_started);
 }
 
-/* Called by the timer interrupt handler at each timer tick.
-   Thus, this function runs in an external interrupt context. */
+/* Called by the timer interrupt handler at each timer tick, with
+   the frame of the code it interrupted.  Thus, this function runs
+   in an external interrupt context. */
 void
-thread_tick (void) 
+thread_tick (const struct intr_frame *f) 
 {
   struct thread *t = thread_current ();
+  struct cpu *c = t->cpu;
 
   /* Update statistics. */
-  if (t == idle_thread)
+  if (t == c->idle_thread)
     idle_ticks++;
-#ifdef USERPROG
-  else if (t->pagedir != NULL)
-    user_ticks++;
-#endif
+  else if ((f->cs & 3) == 3)
+    {
+      user_ticks++;
+      t->user_ticks++;
+    }
   else
-    kernel_ticks++;
+    {
+      kernel_ticks++;
+      t->kernel_ticks++;
+    }
 
   /* Enforce preemption. */
-  if ((++thread_ticks >= TIME_SLICE))
+  if ((++c->thread_ticks >= TIME_SLICE))
     intr_yield_on_return ();
+
+  /* Spread the load.  CPUs take turns so that they do not all
+     scan the run queues on the same tick. */
+  if (cpu_cnt > 1 && timer_ticks () % BALANCE_INTERVAL == c->id)
+    balance (c);
 }
 
 /* Prints thread statistics. */
@@ -157,6 +267,54 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  if (cpu_cnt > 1)
+    printf ("Thread: %lld steals, %lld rebalanced\n", steal_cnt, balance_cnt);
+  printf ("Thread: %lld voluntary switches, %lld involuntary switches, "
+          "%llu cycles ready\n",
+          voluntary_switches, involuntary_switches, ready_cycles);
+  print_latency ("Thread", wakeup_latency);
+
+  if (thread_report_stats) 
+    {
+      enum intr_level old_level = intr_disable ();
+      thread_foreach (print_thread_stats, NULL);
+      intr_set_level (old_level);
+    }
+}
+
+/* Prints histogram HIST of wakeup latencies, as described for
+   wakeup_latency, on a line starting with PREFIX.  Empty buckets
+   are omitted. */
+static void
+print_latency (const char *prefix, const unsigned hist[LATENCY_BUCKETS]) 
+{
+  int i;
+
+  printf ("%s: wakeup latency in cycles:", prefix);
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+    if (hist[i] != 0)
+      {
+        if (i == 0)
+          printf (" <2^%d:%u", LATENCY_SHIFT, hist[i]);
+        else if (i == LATENCY_BUCKETS - 1)
+          printf (" >=2^%d:%u", LATENCY_SHIFT + i - 1, hist[i]);
+        else
+          printf (" 2^%d:%u", LATENCY_SHIFT + i - 1, hist[i]);
+      }
+  printf ("\n");
+}
+
+/* Prints thread T's scheduling statistics.  AUX is ignored, so
+   that this can be passed to thread_foreach(). */
+static void
+print_thread_stats (struct thread *t, void *aux UNUSED) 
+{
+  printf ("%s: %lld user ticks, %lld kernel ticks, "
+          "%u voluntary switches, %u involuntary switches, "
+          "%llu cycles ready\n",
+          t->name, t->user_ticks, t->kernel_ticks, t->voluntary_switches,
+          t->involuntary_switches, t->ready_cycles);
+  print_latency (t->name, t->wakeup_latency);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -188,7 +346,9 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  if (reap_cnt >= REAP_BATCH)
+    thread_reap ();
+  t = alloc_thread ();
   if (t == NULL)
     return TID_ERROR;
 
@@ -196,6 +356,7 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
   t->parent_thread = thread_current();
+  t->affinity = thread_current ()->affinity;
   // list_push_back(&thread_current()->kid_list, &t->kid_elem);
 
   /* Prepare thread for first run by initializing its stack.
@@ -203,6 +364,9 @@ thread_create (const char *name, int priority,
      member cannot be observed. */
   old_level = intr_disable ();
 
+  /* Pick a run queue. */
+  t->cpu = choose_cpu (t, NULL);
+
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
   kf->eip = NULL;
@@ -211,11 +375,6 @@ thread_create (const char *name, int priority,
 
   /* Set the default values for the threads */
   t->load_success = false; 
-  /* Checks whether the console has the lock - iffy implementation :( */
-  t-> acquired_by_console = 0;
-  t->priority_old_release = false;
-  /* Check whether the thread has called lock_release */
-  t->released = false;
   /* Stack frame for switch_entry(). */
   ef = alloc_frame (t, sizeof *ef);
   ef->eip = (void (*) (void)) kernel_thread;
@@ -229,10 +388,7 @@ thread_create (const char *name, int priority,
 
   /* Add to run queue. */
   thread_unblock (t);
-
-  if(t->priority > thread_current()->priority){
-    thread_yield();
-  }
+  thread_yield_to_higher ();
 
   return tid;
 }
@@ -249,9 +405,10 @@ thread_block (void)
 {
   ASSERT (!intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!cpu_current ()->in_softirq);
 
   thread_current ()->status = THREAD_BLOCKED;
-  schedule ();
+  schedule (cpu_current ());
 }
 
 /* Transitions a blocked thread T to the ready-to-run state.
@@ -261,7 +418,9 @@ thread_block (void)
    This function does not preempt the running thread.  This can
    be important: if the caller had disabled interrupts itself,
    it may expect that it can atomically unblock a thread and
-   update other data. */
+   update other data.  T goes on a run queue chosen by
+   choose_cpu(), whose CPU is interrupted if T should preempt
+   what it is running. */
 void
 thread_unblock (struct thread *t) 
 {
@@ -271,13 +430,36 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  // list_push_back (&ready_list, &t->elem);
-  list_insert_ordered(&ready_list, &t->elem, &cmp_priority, NULL);
-
+  ready_push (choose_cpu (t, t->cpu), t);
   t->status = THREAD_READY;
+  t->ready_since = rdtsc ();
+  t->woken = true;
   intr_set_level (old_level);
 }
 
+/* Returns the pages of exited threads that did not fit in the
+   thread cache to the page allocator, in one batch. */
+void
+thread_reap (void) 
+{
+  struct list batch;
+  enum intr_level old_level;
+
+  ASSERT (!intr_context ());
+
+  list_init (&batch);
+  old_level = intr_disable ();
+  if (!list_empty (&reap_list))
+    list_splice (list_end (&batch), list_begin (&reap_list),
+                 list_end (&reap_list));
+  reap_cnt = 0;
+  intr_set_level (old_level);
+
+  while (!list_empty (&batch))
+    palloc_free_page (list_entry (list_pop_front (&batch),
+                                  struct thread, elem));
+}
+
 /* Returns the name of the running thread. */
 const char *
 thread_name (void) 
@@ -322,6 +504,11 @@ thread_exit (void)
   process_exit ();
 #endif
 
+  if (thread_report_stats)
+    print_thread_stats (thread_current (), NULL);
+  fpu_release ();
+  malloc_thread_exit ();
+
   /* Remove thread from all threads list, set our status to dying,
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
@@ -329,32 +516,92 @@ thread_exit (void)
   intr_disable ();
   list_remove (&thread_current()->allelem);
   thread_current()->status = THREAD_DYING;
-  schedule ();
+  schedule (cpu_current ());
   NOT_REACHED ();
 }
 
 /* Yields the CPU.  The current thread is not put to sleep and
-   may be scheduled again immediately at the scheduler's whim. */
+   may be scheduled again immediately at the scheduler's whim.
+   If its affinity mask no longer allows this CPU, it moves to a
+   CPU that it may run on.
+
+   A softirq handler runs in whatever thread it interrupted, so
+   within one the yield is only noted, for the interrupt exit
+   path to carry out (see softirq.c). */
 void
 thread_yield (void) 
+{
+  yield (false);
+}
+
+/* Yields the CPU on the way out of an interrupt handler that
+   asked for it with intr_yield_on_return(), or that ran a
+   softirq that did.  Unlike thread_yield(), which the running
+   thread calls of its own accord, this counts as an involuntary
+   switch. */
+void
+thread_preempt (void) 
+{
+  yield (true);
+}
+
+/* Does the work of thread_yield() and thread_preempt().
+   PREEMPTED says which one it is. */
+static void
+yield (bool preempted) 
 {
   struct thread *cur = thread_current ();
+  struct cpu *c;
   enum intr_level old_level;
   
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) {
-    if(cur->priority == 31)
-      list_push_back (&ready_list, &cur->elem);
-    else
-      list_insert_ordered(&ready_list, &cur->elem, &cmp_priority, NULL);
-  }
+  c = cpu_current ();
+  if (c->in_softirq) 
+    {
+      c->softirq_yield = true;
+      intr_set_level (old_level);
+      return;
+    }
+  if (cur != c->idle_thread) 
+    ready_push (cpu_allowed (cur, c) ? c : choose_cpu (cur, NULL), cur);
   cur->status = THREAD_READY;
-  schedule ();
+  cur->ready_since = rdtsc ();
+  cur->preempted = preempted;
+  schedule (c);
   intr_set_level (old_level);
 }
 
+/* Restricts the current thread to the CPUs whose bits are set in
+   MASK, where bit N stands for cpus[N].  MASK must include at
+   least one online CPU.  Migrates the thread at once if it may no
+   longer run where it is. */
+void
+thread_set_affinity (uint32_t mask) 
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool move;
+
+  ASSERT ((mask & ((1u << cpu_cnt) - 1)) != 0);
+
+  old_level = intr_disable ();
+  cur->affinity = mask;
+  move = !cpu_allowed (cur, cpu_current ());
+  intr_set_level (old_level);
+
+  if (move)
+    thread_yield ();
+}
+
+/* Returns the current thread's CPU affinity mask. */
+uint32_t
+thread_get_affinity (void) 
+{
+  return thread_current ()->affinity;
+}
+
 /* Invoke function 'func' on all threads, passing along 'aux'.
    This function must be called with interrupts off. */
 void
@@ -372,40 +619,77 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY.
+   Priority donated through locks the thread holds still applies,
+   so the effective priority never drops below the highest
+   donation.  Yields if a ready thread now outranks us. */
 void
 thread_set_priority (int new_priority) 
 {
-  // struct thread *cur = thread_current ();
-  // if(cur->released == true){
-  //       printf("helo\n");
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
 
-  //   if(cur->priority_old_release == true){
-  //     cur->priority = cur->priority_old;
-  //   }
+  ASSERT (PRI_MIN <= new_priority && new_priority <= PRI_MAX);
 
-  //   else
-  //     cur->priority = new_priority;
-  // }
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_update_priority (cur);
+  intr_set_level (old_level);
 
-  // else{
-  //   if (new_priority < cur->priority){
-  //     cur->priority_old = new_priority;
-  //   }
+  thread_yield_to_higher ();
+}
 
-  //   else{
-  //     cur->priority = new_priority;
-  //   }
-  // }
-  struct thread *cur = thread_current ();
-  cur->priority = new_priority;
-  /* Sort the donate_list just to ensure correct ordering*/
-  list_sort(&cur->donate_list, &cmp_priority, NULL);
-  struct thread *top = list_entry(list_begin(&ready_list), struct thread, elem);
-  /* Check the priorities and yield if needed */
-  if(top->priority > cur->priority){
-    thread_yield();
-  }
+/* Recomputes T's effective priority as the maximum of its base
+   priority and the highest waiter priority of every lock it
+   holds, which costs O(locks held).  If T is on the ready list,
+   it is moved to keep the list ordered.
+
+   Must be called with interrupts off. */
+void
+thread_update_priority (struct thread *t) 
+{
+  struct list_elem *e;
+  int priority;
+
+  ASSERT (is_thread (t));
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  priority = t->base_priority;
+  for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+       e = list_next (e))
+    {
+      struct lock *l = list_entry (e, struct lock, elem);
+      if (l->max_priority > priority)
+        priority = l->max_priority;
+    }
+
+  if (priority != t->priority)
+    {
+      t->priority = priority;
+      if (t->status == THREAD_READY)
+        {
+          struct cpu *c = t->cpu;
+          ready_remove (t);
+          ready_push (c, t);
+        }
+    }
+}
+
+/* Yields the CPU if a ready thread has a higher priority than
+   the running thread. */
+void
+thread_yield_to_higher (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  struct list *ready_list = &cpu_current ()->ready_list;
+  bool yield = (!list_empty (ready_list)
+                && list_entry (list_front (ready_list), struct thread,
+                               elem)->priority
+                   > thread_current ()->priority);
+  intr_set_level (old_level);
+
+  if (yield)
+    thread_yield ();
 }
 
 /* Returns the current thread's priority. */
@@ -449,19 +733,25 @@ thread_get_recent_cpu (void)
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
-   The idle thread is initially put on the ready list by
+   The BSP's idle thread is initially put on the ready list by
    thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   point it initializes its CPU's idle_thread, "up"s the semaphore
+   passed to it to enable thread_start() to continue, and
+   immediately blocks.  After that, the idle thread never appears
+   in the ready list.  It is returned by next_thread_to_run() as
+   a special case when the ready list is empty.
+
+   Each other CPU runs this function in the thread it started
+   up in, with a null IDLE_STARTED_. */
 static void
-idle (void *idle_started_ UNUSED) 
+idle (void *idle_started_) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
-  sema_up (idle_started);
+  struct thread *cur = thread_current ();
+
+  cur->cpu->idle_thread = cur;
+  if (idle_started != NULL)
+    sema_up (idle_started);
 
   for (;;) 
     {
@@ -480,8 +770,10 @@ idle (void *idle_started_ UNUSED)
          time.
 
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
-         7.11.1 "HLT Instruction". */
-      asm volatile ("sti; hlt" : : : "memory");
+         7.11.1 "HLT Instruction".  intr_enable_and_wait() does
+         this, also giving up the lock that other CPUs need to
+         disable interrupts. */
+      intr_enable_and_wait ();
     }
 }
 
@@ -510,6 +802,17 @@ running_thread (void)
   return pg_round_down (esp);
 }
 
+/* Returns the CPU we are running on.  Unless interrupts are off,
+   we could be moved to another CPU at any time, so the answer
+   may be stale by the time it is used. */
+struct cpu *
+cpu_current (void) 
+{
+  if (!smp_enabled)
+    return &cpus[0];
+  return running_thread ()->cpu;
+}
+
 /* Returns true if T appears to point to a valid thread. */
 static bool
 is_thread (struct thread *t)
@@ -522,6 +825,8 @@ is_thread (struct thread *t)
 static void
 init_thread (struct thread *t, const char *name, int priority)
 {
+  enum intr_level old_level;
+
   ASSERT (t != NULL);
   ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
   ASSERT (name != NULL);
@@ -530,12 +835,13 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  t->affinity = UINT32_MAX;
   t->magic = THREAD_MAGIC;
-  list_push_back (&all_list, &t->allelem);
 
-  /* This is for priority donation. */
-  t->priority_old = priority;
+  old_level = intr_disable ();
+  list_push_back (&all_list, &t->allelem);
+  intr_set_level (old_level);
 
   /* These are our semaphores used for alarm clock of part 1 and wait/load for part. */
   sema_init(&t->sema_sleep, 0);
@@ -550,9 +856,71 @@ init_thread (struct thread *t, const char *name, int priority)
   /* Each thread has its own kid list and its own file descriptor list. */
   list_init (&t->kid_list);
   list_init (&t->fd_list);
-  /* Keep a list of all the threads that donate their priorities */
-  list_init (&t->donate_list);
+  lock_init (&t->fd_lock);
+  /* Locks this thread holds, whose waiters donate priority to it. */
+  list_init (&t->held_locks);
+
+#ifdef USERPROG
+  /* Every thread leads its own process until it joins another. */
+  t->leader = t;
+  list_init (&t->uthreads);
+  sema_init (&t->uthread_exited, 0);
+#endif
+
+}
 
+/* Returns a page for a new thread, from the cache if possible,
+   or a null pointer if memory is short.  Only the struct thread
+   at the bottom of the page is initialized, by init_thread(), so
+   the rest of the page may hold garbage. */
+static struct thread *
+alloc_thread (void) 
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (!list_empty (&thread_cache)) 
+    {
+      t = list_entry (list_pop_front (&thread_cache), struct thread, elem);
+      thread_cache_cnt--;
+    }
+  intr_set_level (old_level);
+
+  if (t == NULL)
+    t = palloc_get_page (0);
+  return t;
+}
+
+/* Disposes of the page of dying thread T, by caching it or
+   queuing it for thread_reap().  Called from
+   thread_schedule_tail(), so it must not sleep.  Interrupts must
+   be off. */
+static void
+free_thread (struct thread *t) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t->magic = 0;
+  if (thread_cache_cnt < THREAD_CACHE_MAX) 
+    {
+      list_push_front (&thread_cache, &t->elem);
+      thread_cache_cnt++;
+    }
+  else 
+    {
+      list_push_back (&reap_list, &t->elem);
+      reap_cnt++;
+      if (reap_cnt >= REAP_BATCH && system_wq != NULL)
+        work_queue (system_wq, &reap_work);
+    }
+}
+
+/* Work function for reap_work. */
+static void
+reap_thread_pages (void *aux UNUSED) 
+{
+  thread_reap ();
 }
 
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
@@ -568,18 +936,247 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-/* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
-   will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+/* Chooses and returns the next thread to be scheduled on CPU C.
+   Should return a thread from C's run queue, unless the run
+   queue is empty.  (If the running thread can continue running,
+   then it will be in the run queue.)  If the run queue is empty,
+   try to steal a thread from another CPU, and failing that
+   return C's idle thread. */
 static struct thread *
-next_thread_to_run (void) 
+next_thread_to_run (struct cpu *c) 
+{
+  struct thread *t;
+
+  if (!list_empty (&c->ready_list))
+    {
+      t = list_entry (list_front (&c->ready_list), struct thread, elem);
+      ready_remove (t);
+      return t;
+    }
+
+  t = cpu_cnt > 1 ? steal_thread (c) : NULL;
+  if (t == NULL)
+    return c->idle_thread;
+  t->cpu = c;
+  steal_cnt++;
+  return t;
+}
+
+/* Returns the priority of the thread that C is running, or
+   PRI_MIN - 1 if C is idle. */
+static int
+cpu_priority (const struct cpu *c) 
 {
-  if (list_empty (&ready_list))
-    return idle_thread;
+  return c->current == c->idle_thread ? PRI_MIN - 1 : c->current->priority;
+}
+
+/* Returns the CPU whose run queue thread T, which is about to
+   become ready, should join.  PREFERRED, if nonnull, is the CPU
+   that T last ran on, whose cache may still hold T's working
+   set, so T goes back there if it would run at once.  Otherwise
+   T goes to the CPU running the lowest priority work, if T
+   outranks it; failing that, back to PREFERRED; failing that, to
+   the shortest run queue.  Only CPUs in T's affinity mask are
+   considered.  Must be called with interrupts off. */
+static struct cpu *
+choose_cpu (struct thread *t, struct cpu *preferred) 
+{
+  struct cpu *lowest = NULL;
+  struct cpu *shortest = NULL;
+  unsigned i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (cpu_cnt == 1)
+    return &cpus[0];
+
+  if (preferred != NULL && !cpu_allowed (t, preferred))
+    preferred = NULL;
+  if (preferred != NULL && t->priority > cpu_priority (preferred))
+    return preferred;
+
+  for (i = 0; i < cpu_cnt; i++) 
+    {
+      struct cpu *c = &cpus[i];
+      if (!cpu_allowed (t, c))
+        continue;
+      if (lowest == NULL || cpu_priority (c) < cpu_priority (lowest))
+        lowest = c;
+      if (shortest == NULL || c->ready_cnt < shortest->ready_cnt)
+        shortest = c;
+    }
+  ASSERT (lowest != NULL);
+
+  if (t->priority > cpu_priority (lowest))
+    return lowest;
+  else if (preferred != NULL)
+    return preferred;
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    return shortest;
+}
+
+/* Adds T to C's run queue, interrupting C if it is another CPU
+   and T should preempt what it is running.  Must be called with
+   interrupts off. */
+static void
+ready_push (struct cpu *c, struct thread *t) 
+{
+  bool remote = c != cpu_current ();
+
+  ASSERT (cpu_allowed (t, c));
+
+  if (remote && t->priority > cpu_priority (c))
+    smp_reschedule (c);
+  t->cpu = c;
+  list_insert_ordered (&c->ready_list, &t->elem, &cmp_priority, NULL);
+  c->ready_cnt++;
+}
+
+/* Removes ready thread T from its CPU's run queue.  Must be
+   called with interrupts off. */
+static void
+ready_remove (struct thread *t) 
+{
+  list_remove (&t->elem);
+  t->cpu->ready_cnt--;
+}
+
+/* Returns the thread on SRC's run queue that CPU DST should take
+   over: of the threads that may run on DST, one with the highest
+   priority, and among those the one that has been off a CPU the
+   longest, since its cache footprint is the likeliest to have
+   gone cold anyway.  Returns a null pointer if no thread on SRC's
+   queue may run on DST. */
+static struct thread *
+pick_migratable (struct cpu *src, struct cpu *dst) 
+{
+  struct thread *best = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&src->ready_list); e != list_end (&src->ready_list);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      if (!cpu_allowed (t, dst))
+        continue;
+
+      /* The queue is in priority order, so nothing further on can
+         beat BEST. */
+      if (best != NULL && t->priority < best->priority)
+        break;
+      if (best == NULL || t->last_ran < best->last_ran)
+        best = t;
+    }
+  return best;
+}
+
+/* Returns the CPU other than C with the longest run queue among
+   those not in TRIED, a mask of CPUs, or a null pointer if every
+   other such queue is empty. */
+static struct cpu *
+busiest_cpu (struct cpu *c, uint32_t tried) 
+{
+  struct cpu *busiest = NULL;
+  unsigned i;
+
+  for (i = 0; i < cpu_cnt; i++) 
+    {
+      struct cpu *v = &cpus[i];
+      if (v != c && (tried & (1u << i)) == 0 && v->ready_cnt > 0
+          && (busiest == NULL || v->ready_cnt > busiest->ready_cnt))
+        busiest = v;
+    }
+  return busiest;
+}
+
+/* Removes and returns a thread for idle CPU C to run from the
+   busiest run queue that has one C may run, or returns a null
+   pointer if there is none.  Must be called with interrupts
+   off. */
+static struct thread *
+steal_thread (struct cpu *c) 
+{
+  uint32_t tried = 0;
+  struct cpu *v;
+
+  while ((v = busiest_cpu (c, tried)) != NULL) 
+    {
+      struct thread *t = pick_migratable (v, c);
+      if (t != NULL) 
+        {
+          ready_remove (t);
+          return t;
+        }
+      tried |= 1u << v->id;
+    }
+  return NULL;
+}
+
+/* Moves ready thread T to C's run queue, and arranges for C to
+   switch to it if it outranks what C is running.  C must be the
+   running CPU.  Must be called with interrupts off. */
+static void
+pull_thread (struct cpu *c, struct thread *t) 
+{
+  ready_remove (t);
+  ready_push (c, t);
+  balance_cnt++;
+  if (t->priority > cpu_priority (c))
+    intr_yield_on_return ();
+}
+
+/* Periodic load balancing for CPU C, called from the timer
+   interrupt.  Pulls one thread from the busiest run queue if it
+   holds at least two more threads than C's, and also pulls a
+   ready thread that outranks what C is running, so that no CPU
+   runs a low priority thread while a higher priority one waits
+   elsewhere. */
+static void
+balance (struct cpu *c) 
+{
+  struct cpu *busiest;
+  unsigned i;
+
+  ASSERT (intr_context ());
+
+  busiest = busiest_cpu (c, 0);
+  if (busiest != NULL && busiest->ready_cnt >= c->ready_cnt + 2) 
+    {
+      struct thread *t = pick_migratable (busiest, c);
+      if (t != NULL)
+        pull_thread (c, t);
+    }
+
+  for (i = 0; i < cpu_cnt; i++) 
+    {
+      struct cpu *v = &cpus[i];
+      struct thread *t;
+
+      if (v == c || v->ready_cnt == 0)
+        continue;
+      t = pick_migratable (v, c);
+      if (t != NULL && t->priority > cpu_priority (c)
+          && t->priority > cpu_priority (v))
+        {
+          pull_thread (c, t);
+          break;
+        }
+    }
+}
+
+/* Returns the wakeup_latency bucket for a latency of CYCLES. */
+static int
+latency_bucket (uint64_t cycles) 
+{
+  int bucket = 0;
+
+  cycles >>= LATENCY_SHIFT - 1;
+  while (cycles > 1 && bucket < LATENCY_BUCKETS - 1) 
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  return bucket;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -607,9 +1204,32 @@ thread_schedule_tail (struct thread *prev)
 
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
+  cur->cpu->current = cur;
 
   /* Start new time slice. */
-  thread_ticks = 0;
+  cur->cpu->thread_ticks = 0;
+
+  /* Let the FPU state follow lazily. */
+  fpu_switch ();
+
+  /* Charge the time we spent waiting to run.  We may have been
+     readied on another CPU whose TSC lags ours, so a negative
+     wait counts as zero. */
+  if (cur != cur->cpu->idle_thread) 
+    {
+      uint64_t now = rdtsc ();
+      uint64_t wait = now > cur->ready_since ? now - cur->ready_since : 0;
+
+      cur->ready_cycles += wait;
+      ready_cycles += wait;
+      if (cur->woken) 
+        {
+          int bucket = latency_bucket (wait);
+          cur->wakeup_latency[bucket]++;
+          wakeup_latency[bucket]++;
+          cur->woken = false;
+        }
+    }
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -621,33 +1241,50 @@ thread_schedule_tail (struct thread *prev)
      pull out the rug under itself.  (We don't free
      initial_thread because its memory was not obtained via
      palloc().) */
+  if (prev != NULL)
+    prev->last_ran = timer_ticks ();
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      free_thread (prev);
     }
 }
 
 /* Schedules a new process.  At entry, interrupts must be off and
    the running process's state must have been changed from
    running to some other state.  This function finds another
-   thread to run and switches to it.
+   thread to run on C, the running CPU, and switches to it.  C is
+   passed in because the running thread may already have been
+   queued on another CPU.
 
    It's not safe to call printf() until thread_schedule_tail()
    has completed. */
 static void
-schedule (void) 
+schedule (struct cpu *c) 
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
+  struct thread *next = next_thread_to_run (c);
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
-  if (cur != next)
-    prev = switch_threads (cur, next);
+  if (cur != next) 
+    {
+      if (cur->status == THREAD_READY && cur->preempted) 
+        {
+          cur->involuntary_switches++;
+          involuntary_switches++;
+        }
+      else if (cur->status != THREAD_DYING) 
+        {
+          cur->voluntary_switches++;
+          voluntary_switches++;
+        }
+      TRACE (TRACE_SWITCH, cur->tid, next->tid);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -2,8 +2,10 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #include "filesys/filesys.h"
 #include "filesys/file.h"
@@ -79,6 +81,9 @@ typedef int tid_t;
    value, triggering the assertion.  (So don't add elements below 
    THREAD_MAGIC.)
 */
+/* Number of buckets in wakeup latency histograms. */
+#define LATENCY_BUCKETS 16
+
 /* The `elem' member has a dual purpose.  It can be an element in
    the run queue (thread.c), or it can be an element in a
    semaphore wait list (synch.c).  It can be used these two ways
@@ -92,14 +97,31 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Effective (donated) priority. */
+    int base_priority;                  /* Priority before donation. */
+    struct cpu *cpu;                    /* CPU we run or are queued on. */
+    void *fpu;                          /* FXSAVE area, see fpu.c. */
+    uint32_t affinity;                  /* Bit N set: may run on cpus[N]. */
+    int64_t last_ran;                   /* Timer tick we last left a CPU. */
+
+    /* Scheduling statistics, owned by thread.c. */
+    int64_t user_ticks;                 /* Timer ticks in user mode. */
+    int64_t kernel_ticks;               /* Timer ticks in the kernel. */
+    unsigned voluntary_switches;        /* Times blocked or yielded. */
+    unsigned involuntary_switches;      /* Times preempted. */
+    bool preempted;                     /* Last yield was a preemption? */
+    uint64_t ready_since;               /* TSC when last made ready. */
+    uint64_t ready_cycles;              /* TSC cycles spent ready. */
+    bool woken;                         /* Readied by thread_unblock()? */
+    unsigned wakeup_latency[LATENCY_BUCKETS]; /* See thread.c. */
     struct list_elem allelem;           /* List element for all threads list. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element.  */
     struct list_elem wait_elem;         /* Wait element.  */
     struct list_elem kid_elem;          /* Kid element.   */
-    struct list_elem donate_elem;       /* Donate element.*/
+    struct list held_locks;             /* Locks held, for donation. */
+    struct lock *waiting_lock;          /* Lock being waited on, if any. */
 
 
     struct semaphore sema_alive;
@@ -110,29 +132,44 @@ struct thread
 
     struct file *file; 
 
-    bool priority_old_release;
-    bool acquired_donate_lock;
-    bool released; 
     int wait; //make sure wait runs once
     struct thread *parent_thread; //pointer to parent thread 
     int load_success; 
-    int priority_lowered; 
 
-    int priority_really_old; 
-    int priority_old;  //this is for our priority donation. it holds the old priority. 
     int fd_next;      //file descriptor in file descriptor list 
     int exit_status; //each thread's exit status 
-    int acquired_by_console;
 
-    struct list donate_list; //list of threads donating priority
     struct list kid_list;   //each thread's children list 
     struct list fd_list;   //file descriptor list
+    struct lock fd_lock;   //protects fd_list and fd_next, in a leader
 
 #ifdef USERPROG
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
+    struct thread *leader;              /* Main thread of our process. */
+    struct uthread *uthread;            /* Our record, if not the leader. */
+
+    /* Owned by userprog/process.c, used only in a leader. */
+    struct list uthreads;               /* Other threads' records. */
+    unsigned live_uthreads;             /* # of other threads alive. */
+    struct semaphore uthread_exited;    /* Upped as each one exits. */
+    uint32_t stack_slots;               /* Bitmap of user thread stacks. */
+    bool exiting;                       /* Is the process exiting? */
+
+    /* Owned by userprog/syscall.c. */
+    void *user_esp;                     /* User esp at system call. */
+#endif
+
+#ifdef VM
+    /* Owned by vm/page.c, used only in a leader. */
+    struct hash pages;                  /* Supplemental page table. */
+    struct lock pages_lock;             /* Protects `pages'. */
+    size_t stack_limit;                 /* Most bytes of any one stack. */
 #endif
 
+    /* Owned by malloc.c. */
+    struct malloc_cache malloc_cache;   /* Free blocks kept for reuse. */
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
@@ -160,15 +197,25 @@ struct list waiting_list;
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, print each thread's scheduling statistics when it
+   exits.  Controlled by kernel command-line option
+   "-thread-stats". */
+extern bool thread_report_stats;
+
 void thread_init (void);
 void thread_start (void);
+struct thread *thread_init_cpu (struct cpu *);
+void thread_start_cpu (void) NO_RETURN;
 
-void thread_tick (void);
+struct intr_frame;
+void thread_tick (const struct intr_frame *);
 void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
 
+void thread_reap (void);
+
 void thread_block (void);
 void thread_unblock (struct thread *);
 
@@ -178,6 +225,7 @@ const char *thread_name (void);
 
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
+void thread_preempt (void);
 
 /* Performs some operation on thread t, given auxiliary data AUX. */
 typedef void thread_action_func (struct thread *t, void *aux);
@@ -185,6 +233,11 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+void thread_update_priority (struct thread *);
+void thread_yield_to_higher (void);
+
+void thread_set_affinity (uint32_t mask);
+uint32_t thread_get_affinity (void);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
@@ -0,0 +1,276 @@
+#include "threads/trace.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/smp.h"
+#include "threads/thread.h"
+#include "threads/tsc.h"
+#include "threads/vaddr.h"
+#ifdef FILESYS
+#include "devices/block.h"
+#endif
+
+/* Size of each CPU's ring buffer. */
+#define TRACE_PAGES 16
+#define TRACE_RECORDS (TRACE_PAGES * PGSIZE / sizeof (struct trace_record))
+
+/* A CPU's ring buffer.  Only the CPU itself writes to it. */
+struct trace_buffer
+  {
+    struct trace_record *records;       /* TRACE_RECORDS records. */
+    size_t head;                        /* Next record to write. */
+    bool wrapped;                       /* Has HEAD wrapped around? */
+  };
+
+static struct trace_buffer buffers[CPU_MAX];
+
+/* True while events are being recorded. */
+bool trace_enabled;
+
+/* Name of the block device to dump to, or a null pointer to dump
+   to the console. */
+static const char *dump_dev_name;
+
+/* TSC and timer readings when tracing started, to work out the
+   TSC frequency. */
+static uint64_t start_tsc;
+static int64_t start_ticks;
+
+/* The dump is a header padded to DUMP_SECTOR_SIZE bytes, followed
+   by the records of CPU 0, oldest first, then those of CPU 1, and
+   so on, padded with zeros to a multiple of DUMP_SECTOR_SIZE
+   bytes.  It is written either to sectors 0, 1, ... of a block
+   device or as hex between "BEGIN TRACE" and "END TRACE" lines on
+   the console. */
+#define DUMP_MAGIC "PINTRACE"
+#define DUMP_VERSION 1
+#define DUMP_SECTOR_SIZE 512
+
+struct trace_header
+  {
+    char magic[8];              /* DUMP_MAGIC, not null-terminated. */
+    uint32_t version;           /* DUMP_VERSION. */
+    uint32_t record_size;       /* sizeof (struct trace_record). */
+    uint32_t cpu_cnt;           /* Number of CPUs. */
+    uint32_t unused;
+    uint64_t tsc_hz;            /* TSC frequency, or 0 if unknown. */
+    uint32_t counts[CPU_MAX];   /* Number of records per CPU. */
+  };
+
+/* Emits the dump's next DUMP_SECTOR_SIZE bytes, SECTOR. */
+typedef void dump_func (const uint8_t *sector, void *aux);
+
+static void dump (const struct trace_header *, dump_func *, void *aux);
+static dump_func dump_hex;
+#ifdef FILESYS
+static size_t dump_size (const struct trace_header *);
+static dump_func dump_block;
+
+/* Where dump_block() writes. */
+struct dump_position
+  {
+    struct block *block;        /* Dump device. */
+    block_sector_t sector;      /* Next sector to write. */
+  };
+#endif
+
+/* Starts tracing, with a buffer for each online CPU.  DEV_NAME
+   names the block device that trace_dump() should write to, or
+   is a null pointer to dump to the console instead. */
+void
+trace_init (const char *dev_name) 
+{
+  unsigned i;
+
+  for (i = 0; i < cpu_cnt; i++) 
+    {
+      buffers[i].records = palloc_get_multiple (0, TRACE_PAGES);
+      if (buffers[i].records == NULL) 
+        {
+          printf ("trace: out of memory, tracing disabled\n");
+          while (i-- > 0)
+            palloc_free_multiple (buffers[i].records, TRACE_PAGES);
+          return;
+        }
+    }
+
+  dump_dev_name = dev_name;
+  start_tsc = rdtsc ();
+  start_ticks = timer_ticks ();
+  trace_enabled = true;
+}
+
+/* Records an event of TYPE with arguments ARG0 and ARG1 in the
+   running CPU's buffer.  Use the TRACE macro instead of calling
+   this directly. */
+void
+trace_event (enum trace_type type, uint32_t arg0, uint32_t arg1) 
+{
+  struct trace_buffer *b;
+  struct cpu *c;
+  uint32_t flags;
+
+  /* Keep this CPU from taking an interrupt, which might record an
+     event into the same slot, but without the lock that
+     intr_disable() takes on SMP: other CPUs never touch this
+     buffer. */
+  asm volatile ("pushfl; popl %0; cli" : "=g" (flags) : : "memory");
+
+  c = cpu_current ();
+  b = &buffers[c->id];
+  if (b->records != NULL) 
+    {
+      struct trace_record *r = &b->records[b->head];
+      if (++b->head >= TRACE_RECORDS) 
+        {
+          b->head = 0;
+          b->wrapped = true;
+        }
+
+      r->tsc = rdtsc ();
+      r->tid = c->current != NULL ? c->current->tid : 0;
+      r->type = type;
+      r->cpu = c->id;
+      r->arg0 = arg0;
+      r->arg1 = arg1;
+    }
+
+  asm volatile ("pushl %0; popfl" : : "g" (flags) : "memory", "cc");
+}
+
+/* Stops tracing and writes out the trace, to the block device
+   given to trace_init() if there is one and it is big enough,
+   otherwise to the console. */
+void
+trace_dump (void) 
+{
+  struct trace_header h;
+  int64_t ticks;
+  unsigned i;
+
+  if (!trace_enabled)
+    return;
+  trace_enabled = false;
+
+  memset (&h, 0, sizeof h);
+  memcpy (h.magic, DUMP_MAGIC, sizeof h.magic);
+  h.version = DUMP_VERSION;
+  h.record_size = sizeof (struct trace_record);
+  h.cpu_cnt = cpu_cnt;
+  ticks = timer_elapsed (start_ticks);
+  if (ticks > 0)
+    h.tsc_hz = (rdtsc () - start_tsc) / ticks * TIMER_FREQ;
+  for (i = 0; i < cpu_cnt; i++)
+    h.counts[i] = buffers[i].wrapped ? TRACE_RECORDS : buffers[i].head;
+
+#ifdef FILESYS
+  if (dump_dev_name != NULL) 
+    {
+      struct block *block = block_get_by_name (dump_dev_name);
+      size_t sectors = dump_size (&h) / DUMP_SECTOR_SIZE;
+
+      if (block == NULL)
+        printf ("trace: %s: no such block device\n", dump_dev_name);
+      else if (block_size (block) < sectors)
+        printf ("trace: %s: too small, need %zu sectors\n",
+                dump_dev_name, sectors);
+      else 
+        {
+          struct dump_position pos;
+          pos.block = block;
+          pos.sector = 0;
+          dump (&h, dump_block, &pos);
+          printf ("trace: %zu sectors written to %s\n",
+                  sectors, dump_dev_name);
+          return;
+        }
+    }
+#endif
+
+  printf ("BEGIN TRACE\n");
+  dump (&h, dump_hex, NULL);
+  printf ("END TRACE\n");
+}
+
+/* Emits the dump described by H through EMIT, passing AUX. */
+static void
+dump (const struct trace_header *h, dump_func *emit, void *aux) 
+{
+  static uint8_t sector[DUMP_SECTOR_SIZE];
+  size_t ofs;
+  unsigned i;
+
+  ASSERT (sizeof *h <= DUMP_SECTOR_SIZE);
+
+  memset (sector, 0, sizeof sector);
+  memcpy (sector, h, sizeof *h);
+  emit (sector, aux);
+
+  ofs = 0;
+  for (i = 0; i < h->cpu_cnt; i++) 
+    {
+      struct trace_buffer *b = &buffers[i];
+      size_t first = b->wrapped ? b->head : 0;
+      size_t j;
+
+      for (j = 0; j < h->counts[i]; j++) 
+        {
+          const uint8_t *r
+            = (const uint8_t *) &b->records[(first + j) % TRACE_RECORDS];
+          size_t k;
+
+          /* Records straddle sector boundaries. */
+          for (k = 0; k < sizeof (struct trace_record); k++) 
+            {
+              sector[ofs++] = r[k];
+              if (ofs == DUMP_SECTOR_SIZE) 
+                {
+                  emit (sector, aux);
+                  ofs = 0;
+                }
+            }
+        }
+    }
+  if (ofs > 0) 
+    {
+      memset (sector + ofs, 0, DUMP_SECTOR_SIZE - ofs);
+      emit (sector, aux);
+    }
+}
+
+/* Prints SECTOR to the console in hex, 32 bytes per line. */
+static void
+dump_hex (const uint8_t *sector, void *aux UNUSED) 
+{
+  size_t i;
+
+  for (i = 0; i < DUMP_SECTOR_SIZE; i++)
+    printf ("%02x%s", sector[i], i % 32 == 31 ? "\n" : "");
+}
+
+#ifdef FILESYS
+/* Returns the number of bytes that dumping with header H emits. */
+static size_t
+dump_size (const struct trace_header *h) 
+{
+  size_t bytes = 0;
+  unsigned i;
+
+  for (i = 0; i < h->cpu_cnt; i++)
+    bytes += h->counts[i] * sizeof (struct trace_record);
+  return DUMP_SECTOR_SIZE + ROUND_UP (bytes, DUMP_SECTOR_SIZE);
+}
+
+/* Writes SECTOR at the struct dump_position that POS_ points to,
+   and advances the position. */
+static void
+dump_block (const uint8_t *sector, void *pos_) 
+{
+  struct dump_position *pos = pos_;
+
+  block_write (pos->block, pos->sector++, sector);
+}
+#endif
@@ -0,0 +1,59 @@
+#ifndef THREADS_TRACE_H
+#define THREADS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Kernel event tracing.
+
+   Each CPU appends fixed-size records, stamped with the TSC, to a
+   ring buffer of its own, so recording an event takes no lock and
+   costs a few dozen cycles.  When the buffer fills, the oldest
+   records are overwritten.  Tracing is off unless the kernel is
+   started with "-trace"; at shutdown trace_dump() writes the
+   buffers out for utils/pintos-trace to decode.
+
+   Define NO_TRACE (e.g. add -DNO_TRACE to DEFINES in a Make.vars
+   file) to compile out every TRACE() call site. */
+
+/* Event types.  utils/pintos-trace knows these by number. */
+enum trace_type
+  {
+    TRACE_SWITCH = 1,           /* Context switch: old tid, new tid. */
+    TRACE_BLOCK_SUBMIT,         /* Block I/O issued: sector, 1 if write. */
+    TRACE_BLOCK_DONE,           /* Block I/O finished: sector, 1 if write. */
+    TRACE_PAGE_FAULT,           /* Page fault: address, eip. */
+    TRACE_SYSCALL_ENTER,        /* System call: number, 0. */
+    TRACE_SYSCALL_EXIT,         /* System call return: number, eax. */
+    TRACE_LOCK_WAIT,            /* Blocking on a lock: lock, holder tid. */
+    TRACE_LOCK_ACQUIRED         /* Got the lock waited for: lock, 0. */
+  };
+
+/* A trace record, as stored in memory and in the dump. */
+struct trace_record
+  {
+    uint64_t tsc;               /* Time-stamp counter. */
+    int32_t tid;                /* Thread running at the time. */
+    uint16_t type;              /* One of enum trace_type. */
+    uint16_t cpu;               /* Recording CPU's index. */
+    uint32_t arg0, arg1;        /* Type-specific, see above. */
+  };
+
+/* Records an event of TYPE with arguments ARG0 and ARG1, if
+   tracing is on.  Arguments are not evaluated if it is off. */
+#ifdef NO_TRACE
+#define TRACE(TYPE, ARG0, ARG1) ((void) 0)
+#else
+#define TRACE(TYPE, ARG0, ARG1)                                 \
+        (trace_enabled                                          \
+         ? trace_event (TYPE, (uint32_t) (ARG0), (uint32_t) (ARG1)) \
+         : (void) 0)
+#endif
+
+extern bool trace_enabled;
+
+void trace_init (const char *dev_name);
+void trace_event (enum trace_type, uint32_t arg0, uint32_t arg1);
+void trace_dump (void);
+
+#endif /* threads/trace.h */
@@ -0,0 +1,311 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of threads and priority of system_wq's pool. */
+#define SYSTEM_WORKERS 2
+#define SYSTEM_PRIORITY PRI_DEFAULT
+
+/* A work queue.  Everything in it is protected by disabling
+   interrupts, so that work can be queued from interrupt
+   handlers. */
+struct workqueue
+  {
+    const char *name;           /* Name, for worker thread names. */
+    struct list queue;          /* Work ready to run, oldest first. */
+    struct semaphore ready;     /* Up'd once per work queued. */
+    unsigned active;            /* Number of works running. */
+    struct list flushers;       /* Threads in workqueue_flush(). */
+  };
+
+/* A thread waiting in workqueue_flush(). */
+struct flusher
+  {
+    struct list_elem elem;      /* Element in workqueue's `flushers'. */
+    struct semaphore done;      /* Up'd when the queue is idle. */
+  };
+
+/* Delayed work from every queue, soonest first.  Protected by
+   disabling interrupts. */
+static struct list delayed_list;
+
+struct workqueue *system_wq;
+
+static thread_func worker;
+
+/* Initializes the work queue system. */
+void
+workqueue_init (void) 
+{
+  list_init (&delayed_list);
+}
+
+/* Starts system_wq.  Must be called after thread_start(). */
+void
+workqueue_start (void) 
+{
+  system_wq = workqueue_create ("kworker", SYSTEM_WORKERS, SYSTEM_PRIORITY);
+  if (system_wq == NULL)
+    PANIC ("could not start system work queue");
+}
+
+/* Creates a work queue named NAME, served by WORKERS threads at
+   PRIORITY.  Returns the new queue, or a null pointer if memory
+   is short.  Must not be called from an interrupt handler. */
+struct workqueue *
+workqueue_create (const char *name, int workers, int priority) 
+{
+  struct workqueue *wq;
+  int i;
+
+  ASSERT (workers > 0);
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  wq = malloc (sizeof *wq);
+  if (wq == NULL)
+    return NULL;
+  wq->name = name;
+  list_init (&wq->queue);
+  sema_init (&wq->ready, 0);
+  wq->active = 0;
+  list_init (&wq->flushers);
+
+  for (i = 0; i < workers; i++) 
+    {
+      char thread_name[16];
+      snprintf (thread_name, sizeof thread_name, "%s/%d", name, i);
+      if (thread_create (thread_name, priority, worker, wq) == TID_ERROR)
+        {
+          /* Workers already started keep running, so WQ must
+             stay allocated, but it is still usable. */
+          if (i > 0)
+            break;
+          free (wq);
+          return NULL;
+        }
+    }
+  return wq;
+}
+
+/* Wakes up the threads flushing WQ if it is idle.  Interrupts
+   must be off. */
+static void
+check_idle (struct workqueue *wq) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (list_empty (&wq->queue) && wq->active == 0)
+    while (!list_empty (&wq->flushers)) 
+      {
+        struct flusher *f = list_entry (list_pop_front (&wq->flushers),
+                                        struct flusher, elem);
+        sema_up (&f->done);
+      }
+}
+
+/* Waits until WQ has no work queued or running.  Delayed work
+   that has not come due yet does not count. */
+void
+workqueue_flush (struct workqueue *wq) 
+{
+  struct flusher f;
+  enum intr_level old_level;
+
+  ASSERT (!intr_context ());
+
+  sema_init (&f.done, 0);
+  old_level = intr_disable ();
+  list_push_back (&wq->flushers, &f.elem);
+  check_idle (wq);
+  intr_set_level (old_level);
+  sema_down (&f.done);
+}
+
+/* Moves delayed work that has come due at tick NOW onto its
+   queue.  Called from the timer interrupt. */
+void
+workqueue_tick (int64_t now) 
+{
+  while (!list_empty (&delayed_list)) 
+    {
+      struct work *w = list_entry (list_front (&delayed_list),
+                                   struct work, elem);
+      if (w->due > now)
+        break;
+      list_pop_front (&delayed_list);
+      w->delayed = false;
+      list_push_back (&w->wq->queue, &w->elem);
+      sema_up (&w->wq->ready);
+    }
+}
+
+/* Initializes W to call FUNC, passing AUX. */
+void
+work_init (struct work *w, work_func *func, void *aux) 
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->wq = NULL;
+  w->pending = false;
+  w->delayed = false;
+  w->one_shot = false;
+}
+
+/* Queues W on WQ.  Returns true if successful, false if W was
+   already pending.  May be called from an interrupt handler. */
+bool
+work_queue (struct workqueue *wq, struct work *w) 
+{
+  enum intr_level old_level;
+  bool queued = false;
+
+  ASSERT (wq != NULL);
+
+  old_level = intr_disable ();
+  if (!w->pending) 
+    {
+      w->pending = true;
+      w->wq = wq;
+      list_push_back (&wq->queue, &w->elem);
+      sema_up (&wq->ready);
+      queued = true;
+    }
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Returns true if delayed work A is due before B. */
+static bool
+due_less (const struct list_elem *a_, const struct list_elem *b_,
+          void *aux UNUSED) 
+{
+  const struct work *a = list_entry (a_, struct work, elem);
+  const struct work *b = list_entry (b_, struct work, elem);
+
+  return a->due < b->due;
+}
+
+/* Queues W on WQ after TICKS timer ticks.  Returns true if
+   successful, false if W was already pending.  May be called
+   from an interrupt handler. */
+bool
+work_queue_delayed (struct workqueue *wq, struct work *w, int64_t ticks) 
+{
+  enum intr_level old_level;
+  bool queued = false;
+
+  ASSERT (wq != NULL);
+
+  if (ticks <= 0)
+    return work_queue (wq, w);
+
+  old_level = intr_disable ();
+  if (!w->pending) 
+    {
+      w->pending = w->delayed = true;
+      w->wq = wq;
+      w->due = timer_ticks () + ticks;
+      list_insert_ordered (&delayed_list, &w->elem, due_less, NULL);
+      queued = true;
+    }
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Removes W from its queue if it is pending.  Returns true if it
+   was, false if it was not pending, although it may be running.
+   May be called from an interrupt handler. */
+bool
+work_cancel (struct work *w) 
+{
+  enum intr_level old_level;
+  bool cancelled = false;
+
+  old_level = intr_disable ();
+  if (w->pending) 
+    {
+      /* A worker that was going to run W finds its queue one
+         shorter than its semaphore says, and goes back to
+         sleep. */
+      list_remove (&w->elem);
+      w->pending = w->delayed = false;
+      check_idle (w->wq);
+      cancelled = true;
+    }
+  intr_set_level (old_level);
+  return cancelled;
+}
+
+/* Queues a call to FUNC, passing AUX, on system_wq.  Returns
+   true if successful, false if memory is short.  Unlike
+   work_queue(), this allocates memory, so it must not be called
+   from an interrupt handler. */
+bool
+queue_work (work_func *func, void *aux) 
+{
+  struct work *w = malloc (sizeof *w);
+  if (w == NULL)
+    return false;
+  work_init (w, func, aux);
+  w->one_shot = true;
+  return work_queue (system_wq, w);
+}
+
+/* Waits until system_wq is idle. */
+void
+flush_work (void) 
+{
+  workqueue_flush (system_wq);
+}
+
+/* A worker thread for work queue WQ_. */
+static void
+worker (void *wq_) 
+{
+  struct workqueue *wq = wq_;
+
+  for (;;) 
+    {
+      enum intr_level old_level;
+      struct work *w;
+      work_func *func;
+      void *aux;
+      bool one_shot;
+
+      sema_down (&wq->ready);
+
+      old_level = intr_disable ();
+      if (list_empty (&wq->queue)) 
+        {
+          /* Cancelled. */
+          intr_set_level (old_level);
+          continue;
+        }
+      w = list_entry (list_pop_front (&wq->queue), struct work, elem);
+      w->pending = false;
+      func = w->func;
+      aux = w->aux;
+      one_shot = w->one_shot;
+      wq->active++;
+      intr_set_level (old_level);
+
+      /* W may be queued again, or freed by its owner, from here
+         on. */
+      func (aux);
+      if (one_shot)
+        free (w);
+
+      old_level = intr_disable ();
+      wq->active--;
+      check_idle (wq);
+      intr_set_level (old_level);
+    }
+}
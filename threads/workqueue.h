@@ -0,0 +1,56 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Work queues.
+
+   A work queue runs functions ("work") in a fixed pool of kernel
+   threads, so that background jobs need not each create a thread
+   of their own.  Work may be queued from an interrupt handler,
+   and may be delayed by a number of timer ticks.  system_wq is
+   shared by everyone; a subsystem that needs a different
+   priority or its own concurrency bound can create another
+   queue. */
+
+struct workqueue;
+
+typedef void work_func (void *aux);
+
+/* A unit of work.  While queued or delayed it is "pending" and
+   belongs to the work queue; queuing it again has no effect
+   until it has started to run. */
+struct work
+  {
+    struct list_elem elem;      /* Queue or delayed list element. */
+    work_func *func;            /* Function to call. */
+    void *aux;                  /* Argument to pass. */
+    struct workqueue *wq;       /* Queue it is pending on, if any. */
+    int64_t due;                /* Tick to queue delayed work at. */
+    bool pending;               /* Queued or delayed? */
+    bool delayed;               /* On the delayed list? */
+    bool one_shot;              /* Allocated by queue_work()? */
+  };
+
+/* The shared work queue. */
+extern struct workqueue *system_wq;
+
+void workqueue_init (void);
+void workqueue_start (void);
+struct workqueue *workqueue_create (const char *name, int workers,
+                                   int priority);
+void workqueue_flush (struct workqueue *);
+void workqueue_tick (int64_t now);
+
+void work_init (struct work *, work_func *, void *aux);
+bool work_queue (struct workqueue *, struct work *);
+bool work_queue_delayed (struct workqueue *, struct work *, int64_t ticks);
+bool work_cancel (struct work *);
+
+/* Shortcuts for system_wq. */
+bool queue_work (work_func *, void *aux);
+void flush_work (void);
+
+#endif /* threads/workqueue.h */
@@ -2,16 +2,23 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "threads/fpu.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/trace.h"
 #include "threads/vaddr.h"
+#include "userprog/process.h"
 #include "userprog/syscall.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void device_not_available (struct intr_frame *);
 
 /* Registers handlers for interrupts that can be caused by user
    programs.
@@ -47,7 +54,7 @@ exception_init (void)
   intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
   intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
   intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
-  intr_register_int (7, 0, INTR_ON, kill,
+  intr_register_int (7, 0, INTR_ON, device_not_available,
                      "#NM Device Not Available Exception");
   intr_register_int (11, 0, INTR_ON, kill, "#NP Segment Not Present");
   intr_register_int (12, 0, INTR_ON, kill, "#SS Stack Fault Exception");
@@ -111,6 +118,16 @@ kill (struct intr_frame *f)
     }
 }
 
+/* #NM handler.  A user program's first FPU instruction after a
+   thread switch lands here; see threads/fpu.c.  The kernel
+   itself never uses the FPU. */
+static void
+device_not_available (struct intr_frame *f) 
+{
+  if (f->cs != SEL_UCSEG || !fpu_activate ())
+    kill (f);
+}
+
 /* Page fault handler.  This is a skeleton that must be filled in
    to implement virtual memory.  Some solutions to project 2 may
    also require modifying this code.
@@ -125,14 +142,6 @@ kill (struct intr_frame *f)
 static void
 page_fault (struct intr_frame *f) 
 {
-
-
-  /*Checks the pointers for the bad.___ test cases*/
-  if (f == NULL || !is_user_vaddr(f) || (f->esp) == NULL || !is_user_vaddr(f->esp))
-    sys_exit(-1);
-  /*Note, we want to sys_exit instead of our exit call*/
-
-
   bool not_present;  /* True: not-present page, false: writing r/o page. */
   bool write;        /* True: access was write, false: access was read. */
   bool user;         /* True: access by user, false: access by kernel. */
@@ -146,7 +155,7 @@ page_fault (struct intr_frame *f)
      [IA32-v3a] 5.15 "Interrupt 14--Page Fault Exception
      (#PF)". */
   asm ("movl %%cr2, %0" : "=r" (fault_addr));
-
+  TRACE (TRACE_PAGE_FAULT, fault_addr, f->eip);
 
   /* Turn interrupts back on (they were only off so that we could
      be assured of reading CR2 before it changed). */
@@ -160,6 +169,27 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
+  /* Bring in a page the process has not touched yet, or grow the
+     running thread's stack.  This also covers the kernel touching
+     user memory on the process's behalf, as in a system call, in
+     which case F holds the kernel's stack pointer, not the
+     user's. */
+  if (not_present) 
+    {
+      void *esp = user ? f->esp : thread_current ()->user_esp;
+#ifdef VM
+      if (page_load (fault_addr))
+        return;
+#endif
+      if (process_grow_stack (fault_addr, esp))
+        return;
+    }
+
+  /*Checks the pointers for the bad.___ test cases*/
+  if (f == NULL || !is_user_vaddr(f) || (f->esp) == NULL || !is_user_vaddr(f->esp))
+    sys_exit(-1);
+  /*Note, we want to sys_exit instead of our exit call*/
+
   /* To implement virtual memory, delete the rest of the function
      body, and replace it with code that brings in the page to
      which fault_addr refers. */
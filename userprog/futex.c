@@ -0,0 +1,271 @@
+#include "userprog/futex.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#endif
+
+/* Fast user-space mutexes.
+
+   A user program keeps its lock word in its own memory and
+   manipulates it with atomic instructions, entering the kernel
+   only under contention: futex_wait() sleeps as long as the word
+   still holds the value the caller last saw, and futex_wake()
+   wakes sleepers after the word changes.
+
+   Sleepers are kept in wait queues hashed by the physical
+   address of the word, so that every mapping of the same memory
+   finds the same queue.  A queue exists only while it has
+   sleepers.  With virtual memory, a page could move to another
+   frame behind a sleeper's back, so each sleeper keeps its
+   word's page pinned until it wakes, and a word whose page is
+   not in memory is faulted in first. */
+
+/* Wait queue for one futex word. */
+struct futex_queue
+  {
+    uintptr_t key;              /* Physical address of the word. */
+    struct list waiters;        /* List of struct futex_waiter. */
+    struct hash_elem hash_elem; /* Element in futex_queues. */
+  };
+
+/* A thread sleeping in futex_wait(). */
+struct futex_waiter
+  {
+    struct semaphore sema;      /* Upped to wake the thread. */
+    struct list_elem elem;      /* Element in futex_queue's waiters. */
+    struct thread *thread;      /* The sleeping thread. */
+    bool aborted;               /* Woken because its process is exiting? */
+  };
+
+/* Wait queues, keyed by physical address. */
+static struct hash futex_queues;
+
+/* Protects futex_queues and the queues in it. */
+static struct lock futex_lock;
+
+static hash_hash_func futex_hash;
+static hash_less_func futex_less;
+
+/* Initializes the futex wait queues. */
+void
+futex_init (void) 
+{
+  hash_init (&futex_queues, futex_hash, futex_less, NULL);
+  lock_init (&futex_lock);
+}
+
+/* Translates user address UADDR of a futex word in the running
+   process into a kernel virtual address, bringing its page into
+   memory if need be and keeping it there until futex_release().
+   Returns a null pointer if UADDR is misaligned or not mapped. */
+static int32_t *
+futex_translate (int32_t *uaddr) 
+{
+  if ((uintptr_t) uaddr % sizeof *uaddr != 0 || !is_user_vaddr (uaddr))
+    return NULL;
+#ifdef VM
+  for (;;) 
+    {
+      int32_t *kaddr = frame_pin (uaddr);
+      if (kaddr != NULL)
+        return kaddr;
+      if (!page_load (uaddr))
+        return NULL;
+    }
+#else
+  return pagedir_get_page (thread_current ()->pagedir, uaddr);
+#endif
+}
+
+/* Lets the page of KADDR, obtained from futex_translate(), be
+   evicted again. */
+static void
+futex_release (int32_t *kaddr UNUSED) 
+{
+#ifdef VM
+  frame_unpin (kaddr);
+#endif
+}
+
+/* Returns the wait queue for the futex word at kernel address
+   KADDR.  If there is none and CREATE is true, creates one;
+   otherwise returns a null pointer.  futex_lock must be held. */
+static struct futex_queue *
+futex_queue_lookup (int32_t *kaddr, bool create) 
+{
+  struct futex_queue key, *q;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&futex_lock));
+
+  key.key = vtop (kaddr);
+  e = hash_find (&futex_queues, &key.hash_elem);
+  if (e != NULL)
+    return hash_entry (e, struct futex_queue, hash_elem);
+  if (!create)
+    return NULL;
+
+  q = malloc (sizeof *q);
+  if (q != NULL)
+    {
+      q->key = key.key;
+      list_init (&q->waiters);
+      hash_insert (&futex_queues, &q->hash_elem);
+    }
+  return q;
+}
+
+/* If the futex word at user address UADDR equals EXPECTED,
+   sleeps until futex_wake() is called for it and returns 0.
+   Otherwise returns -1 right away, as it does if UADDR is not a
+   valid futex address or memory is short.  The comparison and
+   going to sleep are atomic with respect to futex_wake().  Also
+   returns -1 if the process is exiting, or starts to while we
+   sleep. */
+int
+futex_wait (int32_t *uaddr, int32_t expected) 
+{
+  struct futex_waiter w;
+  struct futex_queue *q;
+  int32_t *kaddr;
+
+  kaddr = futex_translate (uaddr);
+  if (kaddr == NULL)
+    return -1;
+
+  lock_acquire (&futex_lock);
+  if (*kaddr != expected || process_exiting ()
+      || (q = futex_queue_lookup (kaddr, true)) == NULL)
+    {
+      lock_release (&futex_lock);
+      futex_release (kaddr);
+      return -1;
+    }
+  sema_init (&w.sema, 0);
+  w.thread = thread_current ();
+  w.aborted = false;
+  list_push_back (&q->waiters, &w.elem);
+  lock_release (&futex_lock);
+
+  sema_down (&w.sema);
+  futex_release (kaddr);
+  return w.aborted ? -1 : 0;
+}
+
+/* Wakes up to CNT threads sleeping on the futex word at user
+   address UADDR, in the order they went to sleep.  Returns the
+   number of threads woken, or -1 if UADDR is not a valid futex
+   address. */
+int
+futex_wake (int32_t *uaddr, int cnt) 
+{
+  struct futex_queue *q;
+  int32_t *kaddr;
+  int woken = 0;
+
+  kaddr = futex_translate (uaddr);
+  if (kaddr == NULL)
+    return -1;
+
+  lock_acquire (&futex_lock);
+  q = futex_queue_lookup (kaddr, false);
+  if (q != NULL)
+    {
+      while (woken < cnt && !list_empty (&q->waiters))
+        {
+          struct futex_waiter *w = list_entry (list_pop_front (&q->waiters),
+                                               struct futex_waiter, elem);
+          sema_up (&w->sema);
+          woken++;
+        }
+      if (list_empty (&q->waiters))
+        {
+          hash_delete (&futex_queues, &q->hash_elem);
+          free (q);
+        }
+    }
+  lock_release (&futex_lock);
+  futex_release (kaddr);
+
+  return woken;
+}
+
+/* Wakes every thread of the process led by LEADER that is
+   sleeping in futex_wait(), because the process is exiting. */
+void
+futex_wake_process (struct thread *leader) 
+{
+  struct hash_iterator i;
+  bool deleted;
+
+  lock_acquire (&futex_lock);
+  hash_first (&i, &futex_queues);
+  while (hash_next (&i))
+    {
+      struct futex_queue *q = hash_entry (hash_cur (&i), struct futex_queue,
+                                          hash_elem);
+      struct list_elem *e, *next;
+
+      for (e = list_begin (&q->waiters); e != list_end (&q->waiters); e = next)
+        {
+          struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+
+          next = list_next (e);
+          if (w->thread->leader == leader)
+            {
+              list_remove (e);
+              w->aborted = true;
+              sema_up (&w->sema);
+            }
+        }
+    }
+
+  /* Deleting invalidates the iterator, so start over after each
+     emptied queue we remove. */
+  do 
+    {
+      deleted = false;
+      hash_first (&i, &futex_queues);
+      while (hash_next (&i))
+        {
+          struct futex_queue *q = hash_entry (hash_cur (&i),
+                                              struct futex_queue, hash_elem);
+          if (list_empty (&q->waiters))
+            {
+              hash_delete (&futex_queues, &q->hash_elem);
+              free (q);
+              deleted = true;
+              break;
+            }
+        }
+    }
+  while (deleted);
+  lock_release (&futex_lock);
+}
+
+/* Returns a hash value for futex queue E. */
+static unsigned
+futex_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct futex_queue *q = hash_entry (e, struct futex_queue, hash_elem);
+  return hash_bytes (&q->key, sizeof q->key);
+}
+
+/* Returns true if futex queue A precedes futex queue B. */
+static bool
+futex_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED) 
+{
+  const struct futex_queue *a = hash_entry (a_, struct futex_queue, hash_elem);
+  const struct futex_queue *b = hash_entry (b_, struct futex_queue, hash_elem);
+  return a->key < b->key;
+}
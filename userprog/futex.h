@@ -0,0 +1,12 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+#include <stdint.h>
+#include "threads/thread.h"
+
+void futex_init (void);
+int futex_wait (int32_t *uaddr, int32_t expected);
+int futex_wake (int32_t *uaddr, int cnt);
+void futex_wake_process (struct thread *leader);
+
+#endif /* userprog/futex.h */
@@ -35,22 +35,38 @@ static uint64_t make_gdtr_operand (uint16_t limit, void *base);
 void
 gdt_init (void)
 {
-  uint64_t gdtr_operand;
-
   /* Initialize GDT. */
   gdt[SEL_NULL / sizeof *gdt] = 0;
   gdt[SEL_KCSEG / sizeof *gdt] = make_code_desc (0);
   gdt[SEL_KDSEG / sizeof *gdt] = make_data_desc (0);
   gdt[SEL_UCSEG / sizeof *gdt] = make_code_desc (3);
   gdt[SEL_UDSEG / sizeof *gdt] = make_data_desc (3);
-  gdt[SEL_TSS / sizeof *gdt] = make_tss_desc (tss_get ());
+  gdt_init_cpu (&cpus[0]);
+
+  gdt_load ();
+}
 
-  /* Load GDTR, TR.  See [IA32-v3a] 2.4.1 "Global Descriptor
-     Table Register (GDTR)", 2.4.4 "Task Register (TR)", and
-     6.2.4 "Task Register".  */
-  gdtr_operand = make_gdtr_operand (sizeof gdt - 1, gdt);
+/* Adds the descriptor for CPU C's TSS to the GDT.  Each CPU
+   needs its own, because loading the task register marks the
+   descriptor busy. */
+void
+gdt_init_cpu (struct cpu *c) 
+{
+  ASSERT (c->id < CPU_MAX);
+  ASSERT (c->tss != NULL);
+  gdt[SEL_TSS_CPU (c->id) / sizeof *gdt] = make_tss_desc (c->tss);
+}
+
+/* Loads the GDT and the running CPU's TSS into the GDTR and TR.
+   See [IA32-v3a] 2.4.1 "Global Descriptor Table Register
+   (GDTR)", 2.4.4 "Task Register (TR)", and 6.2.4 "Task
+   Register". */
+void
+gdt_load (void) 
+{
+  uint64_t gdtr_operand = make_gdtr_operand (sizeof gdt - 1, gdt);
   asm volatile ("lgdt %0" : : "m" (gdtr_operand));
-  asm volatile ("ltr %w0" : : "q" (SEL_TSS));
+  asm volatile ("ltr %w0" : : "q" (SEL_TSS_CPU (cpu_current ()->id)));
 }
 
 /* System segment or code/data segment? */
@@ -5,6 +5,7 @@
 #include "threads/init.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
@@ -250,7 +251,8 @@ active_pd (void)
 
    This function invalidates the TLB if PD is the active page
    directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   the TLB, so there is no need to invalidate anything.)  Other
+   CPUs running threads of the same process do likewise. */
 static void
 invalidate_pagedir (uint32_t *pd) 
 {
@@ -259,5 +261,6 @@ invalidate_pagedir (uint32_t *pd)
       /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
       pagedir_activate (pd);
-    } 
+    }
+  smp_tlb_shootdown (pd); 
 }
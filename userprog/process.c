@@ -18,10 +18,20 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "userprog/syscall.h"
+#include "userprog/futex.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
+static thread_func start_uthread NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+#ifndef VM
+static bool install_page (void *upage, void *kpage, bool writable);
+#endif
+static uint8_t *uthread_stack_top (int slot);
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -45,7 +55,7 @@ process_execute (const char *file_name)
   tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
 
   /* Keep a pointer to all of the newly created child processes */
-  struct process *child = malloc(sizeof(struct process));
+  struct process *child = kmem_cache_alloc(process_cache);
   child->pid = tid;
   /* Add the children to the kiddy list */
   list_push_back(&thread_current()->kid_list, &child->process_elem);
@@ -109,18 +119,75 @@ process_wait (tid_t child_tid UNUSED)
   return -1;
 }
 
-/* Free the current process's resources. */
+/* Free the current process's resources.
+
+   A thread other than the main thread only gives back its stack
+   and reports its exit, since everything else is shared.  The
+   main thread first makes sure that the rest of the process's
+   threads are on their way out and waits for them, because they
+   share its page directory and the file descriptors kept in its
+   struct thread.  Last, it reports the exit status that
+   whichever thread called sys_exit() first left for it. */
 void
 process_exit (void)
 {
   struct thread *cur = thread_current ();
+  struct thread *leader = cur->leader;
   uint32_t *pd;
+
+  if (leader != cur)
+    {
+      struct uthread *ut = cur->uthread;
+      uint8_t *top = uthread_stack_top (ut->slot);
+      uint8_t *upage;
+      enum intr_level old_level;
+
+      for (upage = top - UTHREAD_STACK_SIZE; upage < top; upage += PGSIZE)
+        {
+#ifdef VM
+          page_remove (upage);
+#else
+          void *kpage = pagedir_get_page (cur->pagedir, upage);
+          if (kpage != NULL)
+            {
+              pagedir_clear_page (cur->pagedir, upage);
+              palloc_free_page (kpage);
+            }
+#endif
+        }
+      cur->pagedir = NULL;
+      pagedir_activate (NULL);
+
+      old_level = intr_disable ();
+      leader->stack_slots &= ~(1u << ut->slot);
+      leader->live_uthreads--;
+      sema_up (&ut->done);
+      sema_up (&leader->uthread_exited);
+      intr_set_level (old_level);
+      return;
+    }
+
+  if (cur->live_uthreads > 0)
+    {
+      process_begin_exit ();
+      while (cur->live_uthreads > 0)
+        sema_down (&cur->uthread_exited);
+    }
+  while (!list_empty (&cur->uthreads))
+    free (list_entry (list_pop_front (&cur->uthreads),
+                      struct uthread, elem));
   
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
   pd = cur->pagedir;
   if (pd != NULL) 
     {
+#ifdef VM
+      /* Give back the pages in the frame table and swap while
+         the page directory still maps them. */
+      page_table_destroy ();
+#endif
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -133,6 +200,343 @@ process_exit (void)
       pagedir_destroy (pd);
     }
 
+  /* Only now is the process really gone, so only now may our
+     parent's wait() return. */
+  if (cur->exiting)
+    sys_exit_report ();
+}
+
+/* Marks the running thread's process as exiting, so that each
+   of its threads terminates the next time it would return to
+   user mode, and wakes any of them sleeping on a futex.  Returns
+   true if this call started the exit, false if the process was
+   already exiting. */
+bool
+process_begin_exit (void)
+{
+  struct thread *leader = thread_current ()->leader;
+  enum intr_level old_level;
+  bool first;
+
+  old_level = intr_disable ();
+  first = !leader->exiting;
+  leader->exiting = true;
+  intr_set_level (old_level);
+
+  if (first)
+    futex_wake_process (leader);
+  return first;
+}
+
+/* Returns true if the running thread's process is exiting. */
+bool
+process_exiting (void)
+{
+  return thread_current ()->leader->exiting;
+}
+
+/* Information passed from process_thread_create() to a new user
+   thread. */
+struct uthread_start
+  {
+    struct thread *leader;      /* Main thread of the process. */
+    struct uthread *uthread;    /* New thread's record. */
+    void *eip;                  /* User entry point. */
+    void *func;                 /* First argument to EIP. */
+    void *aux;                  /* Second argument to EIP. */
+    struct semaphore started;   /* Upped once the thread is set up. */
+    bool success;               /* Did setting up succeed? */
+  };
+
+/* Creates a new thread in the running thread's process, sharing
+   its address space and open files, that starts in user mode at
+   EIP as if called as EIP(FUNC, AUX) with a null return address.
+   The new thread gets its own stack below the main thread's.
+   Returns the new thread's tid, or TID_ERROR if the process has
+   too many threads or memory is short. */
+tid_t
+process_thread_create (void *eip, void *func, void *aux) 
+{
+  struct thread *leader = thread_current ()->leader;
+  struct uthread_start start;
+  struct uthread *ut;
+  enum intr_level old_level;
+  int slot;
+  tid_t tid;
+
+  ut = malloc (sizeof *ut);
+  if (ut == NULL)
+    return TID_ERROR;
+
+  /* Claim a stack slot. */
+  old_level = intr_disable ();
+  for (slot = 0; slot < UTHREAD_MAX; slot++)
+    if ((leader->stack_slots & (1u << slot)) == 0)
+      break;
+  if (slot < UTHREAD_MAX)
+    {
+      leader->stack_slots |= 1u << slot;
+      leader->live_uthreads++;
+    }
+  intr_set_level (old_level);
+  if (slot == UTHREAD_MAX)
+    {
+      free (ut);
+      return TID_ERROR;
+    }
+
+  ut->tid = TID_ERROR;
+  ut->slot = slot;
+  ut->status = -1;
+  ut->joined = false;
+  sema_init (&ut->done, 0);
+  old_level = intr_disable ();
+  list_push_back (&leader->uthreads, &ut->elem);
+  intr_set_level (old_level);
+
+  start.leader = leader;
+  start.uthread = ut;
+  start.eip = eip;
+  start.func = func;
+  start.aux = aux;
+  sema_init (&start.started, 0);
+  start.success = false;
+
+  tid = thread_create (leader->name, PRI_DEFAULT, start_uthread, &start);
+  if (tid != TID_ERROR)
+    sema_down (&start.started);
+  else
+    {
+      /* Nothing ran, so undo the bookkeeping ourselves. */
+      old_level = intr_disable ();
+      leader->stack_slots &= ~(1u << slot);
+      leader->live_uthreads--;
+      intr_set_level (old_level);
+      sema_up (&ut->done);
+    }
+
+  if (!start.success)
+    {
+      /* The thread, if any, has exited or is about to. */
+      sema_down (&ut->done);
+      old_level = intr_disable ();
+      list_remove (&ut->elem);
+      intr_set_level (old_level);
+      free (ut);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
+/* Thread function that sets up a user thread created by
+   process_thread_create() and starts it running. */
+static void
+start_uthread (void *start_) 
+{
+  struct uthread_start *start = start_;
+  struct thread *cur = thread_current ();
+  struct thread *leader = start->leader;
+  struct intr_frame if_;
+  uint32_t *esp;
+#ifndef VM
+  uint8_t *kpage;
+#endif
+
+  cur->leader = leader;
+  cur->uthread = start->uthread;
+  cur->uthread->tid = cur->tid;
+  cur->parent_thread = leader->parent_thread;
+  cur->pagedir = leader->pagedir;
+  process_activate ();
+
+  /* Map the top page of our stack and push EIP's arguments.  The
+     rest of the stack is mapped as it is used. */
+  esp = (uint32_t *) uthread_stack_top (cur->uthread->slot);
+#ifdef VM
+  if (!page_add_zero ((uint8_t *) esp - PGSIZE, true)
+      || !page_load ((uint8_t *) esp - PGSIZE))
+    {
+      sema_up (&start->started);
+      thread_exit ();
+    }
+#else
+  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+  if (kpage == NULL || !install_page ((uint8_t *) esp - PGSIZE, kpage, true))
+    {
+      palloc_free_page (kpage);
+      sema_up (&start->started);
+      thread_exit ();
+    }
+#endif
+  *--esp = (uint32_t) start->aux;
+  *--esp = (uint32_t) start->func;
+  *--esp = 0;
+
+  memset (&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+  if_.eip = start->eip;
+  if_.esp = esp;
+
+  /* START lives on our creator's stack, so this must be the last
+     time we touch it. */
+  start->success = true;
+  sema_up (&start->started);
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Waits for user thread TID, which must belong to the running
+   thread's process, to exit and returns its exit status.
+   Returns -1 immediately if TID is not such a thread or if it
+   has already been joined. */
+int
+process_thread_join (tid_t tid) 
+{
+  struct thread *leader = thread_current ()->leader;
+  struct uthread *ut = NULL;
+  struct list_elem *e;
+  enum intr_level old_level;
+  int status;
+
+  /* Other threads of the process may create and join threads
+     concurrently. */
+  old_level = intr_disable ();
+  for (e = list_begin (&leader->uthreads); e != list_end (&leader->uthreads);
+       e = list_next (e))
+    {
+      struct uthread *u = list_entry (e, struct uthread, elem);
+      if (u->tid == tid && tid != TID_ERROR)
+        {
+          ut = u;
+          break;
+        }
+    }
+  if (ut == NULL || ut->joined || tid == thread_tid ())
+    {
+      intr_set_level (old_level);
+      return -1;
+    }
+  ut->joined = true;
+  intr_set_level (old_level);
+
+  sema_down (&ut->done);
+  status = ut->status;
+
+  old_level = intr_disable ();
+  list_remove (&ut->elem);
+  intr_set_level (old_level);
+  free (ut);
+  return status;
+}
+
+/* Terminates the running user thread with exit status STATUS,
+   which process_thread_join() returns.  For a process's main
+   thread this is the same as exit(STATUS). */
+void
+process_thread_exit (int status) 
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->leader == cur)
+    sys_exit (status);
+
+  cur->uthread->status = status;
+  thread_exit ();
+}
+
+/* Returns the user virtual address of the top of the stack for
+   the user thread in stack slot SLOT. */
+static uint8_t *
+uthread_stack_top (int slot) 
+{
+  ASSERT (slot >= 0 && slot < UTHREAD_MAX);
+  return ((uint8_t *) PHYS_BASE - MAIN_STACK_SIZE
+          - (size_t) slot * UTHREAD_STACK_SIZE);
+}
+
+/* Stores in *BOTTOM and *TOP the range of user addresses that
+   the running thread's stack may grow to fill: its stack slot for
+   a user thread, the MAIN_STACK_SIZE bytes below PHYS_BASE for a
+   process's main thread.  Either way the lowest page is left out
+   as a guard.  With VM, the process's stack limit caps both
+   kinds of stack. */
+static void
+stack_bounds (uint8_t **bottom, uint8_t **top) 
+{
+  struct thread *cur = thread_current ();
+
+  if (cur->uthread != NULL)
+    {
+      *top = uthread_stack_top (cur->uthread->slot);
+      *bottom = *top - UTHREAD_STACK_SIZE + PGSIZE;
+    }
+  else
+    {
+      *top = PHYS_BASE;
+      *bottom = *top - MAIN_STACK_SIZE + PGSIZE;
+    }
+#ifdef VM
+  if ((size_t) (*top - *bottom) > cur->leader->stack_limit)
+    *bottom = *top - cur->leader->stack_limit;
+#endif
+}
+
+/* Grows the running thread's stack to cover user virtual address
+   ADDR, which faulted while the thread's stack pointer was ESP,
+   if the access looks like a stack access.  Returns true if ADDR
+   is now mapped, false if it is not a stack access, lies outside
+   the thread's stack, or memory is short.
+
+   PUSH checks access permissions 4 bytes below the stack
+   pointer, and PUSHA 32 bytes below, before it moves the stack
+   pointer, so accesses that far below ESP count as stack
+   accesses too.  Only the page containing ADDR is added, zeroed,
+   so a thread commits memory only for the part of its stack it
+   actually uses.
+
+   Without VM, only user threads' stacks grow.  A main thread's
+   stack stays the single page that setup_stack() maps.  A kernel
+   thread has no user stack at all, so a fault on a user address
+   there is a kernel bug and must not be papered over. */
+bool
+process_grow_stack (const void *addr, const void *esp) 
+{
+  uint8_t *upage = pg_round_down (addr);
+  uint8_t *bottom, *top;
+
+  if (thread_current ()->leader->pagedir == NULL || esp == NULL)
+    return false;
+#ifndef VM
+  if (thread_current ()->uthread == NULL)
+    return false;
+#endif
+
+  stack_bounds (&bottom, &top);
+  if (upage < bottom || upage >= top
+      || (const uint8_t *) addr + 32 < (const uint8_t *) esp)
+    return false;
+
+#ifdef VM
+  /* If another thread of the process got here first, the page is
+     already there, which is just as good. */
+  page_add_zero (upage, true);
+  return page_load (addr);
+#else
+  {
+    uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+    if (kpage == NULL)
+      return false;
+    if (!install_page (upage, kpage, true))
+      {
+        palloc_free_page (kpage);
+        return false;
+      }
+    return true;
+  }
+#endif
 }
 
 /* Sets up the CPU for running user code in the current
@@ -246,10 +650,21 @@ load (const char *file_name, void (**eip) (void), void **esp)
   bool first = true;
 
   *esp = (unsigned char *) esp;
+#ifdef VM
+  /* Allocate supplemental page table. */
+  if (!page_table_init ())
+    goto done;
+#endif
+
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
-    goto done;
+    {
+#ifdef VM
+      page_table_destroy ();
+#endif
+      goto done;
+    }
   process_activate ();
 
   /* Set up stack. */
@@ -416,8 +831,6 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /* load() helpers. */
 
-static bool install_page (void *upage, void *kpage, bool writable);
-
 /* Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
 static bool
@@ -475,6 +888,11 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
+   With VM, nothing is read here: each page is only recorded in
+   the supplemental page table, and is read in by page_fault()
+   the first time the process touches it.  FILE must then stay
+   open for as long as the process runs.
+
    Return true if successful, false if a memory allocation error
    or disk read error occurs. */
 static bool
@@ -485,7 +903,9 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifndef VM
   file_seek (file, ofs);
+#endif
   while (read_bytes > 0 || zero_bytes > 0) 
     {
       /* Calculate how to fill this page.
@@ -494,6 +914,14 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+#ifdef VM
+      /* Record where this page comes from. */
+      if (!(page_read_bytes > 0
+            ? page_add_file (upage, file, ofs, page_read_bytes, writable)
+            : page_add_zero (upage, writable)))
+        return false;
+      ofs += page_read_bytes;
+#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if (kpage == NULL)
@@ -513,6 +941,7 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
+#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
@@ -529,6 +958,16 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 static bool
 setup_stack (void **esp) 
 {
+#ifdef VM
+  /* With VM the stack page is a zero page like any other, so it
+     can be evicted. */
+  uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
+
+  if (!page_add_zero (upage, true) || !page_load (upage))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -542,8 +981,10 @@ setup_stack (void **esp)
         palloc_free_page (kpage);
     }
   return success;
+#endif
 }
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -563,3 +1004,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
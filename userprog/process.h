@@ -2,10 +2,45 @@
 #define USERPROG_PROCESS_H
 
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Address space reserved for the main thread's stack, just
+   below PHYS_BASE. */
+#define MAIN_STACK_SIZE (8 * 1024 * 1024)
+
+/* Additional user threads in a process.  Thread stacks are
+   carved out below the main thread's stack, UTHREAD_STACK_SIZE
+   bytes apiece.  Like the main thread's stack, each starts as a
+   single page and grows on demand, and its lowest page is never
+   mapped, so that overflowing it faults instead of running into
+   the next stack. */
+#define UTHREAD_MAX 32
+#define UTHREAD_STACK_SIZE (16 * PGSIZE)
+
+/* Record of a user thread other than its process's main thread.
+   Kept on the leader's `uthreads' list until joined or until the
+   whole process exits, so that the exit status outlives the
+   thread. */
+struct uthread
+  {
+    tid_t tid;                  /* Thread identifier. */
+    int status;                 /* Exit status. */
+    int slot;                   /* Stack slot. */
+    bool joined;                /* Has someone joined (or begun to)? */
+    struct semaphore done;      /* Upped when the thread exits. */
+    struct list_elem elem;      /* Element in leader's uthreads. */
+  };
 
 tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
 
+tid_t process_thread_create (void *eip, void *func, void *aux);
+int process_thread_join (tid_t);
+void process_thread_exit (int status) NO_RETURN;
+bool process_begin_exit (void);
+bool process_exiting (void);
+bool process_grow_stack (const void *addr, const void *esp);
+
 #endif /* userprog/process.h */
@@ -10,8 +10,14 @@
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "userprog/futex.h"
+#include "userprog/process.h"
+#include "threads/trace.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
-static struct lock rw_lock;
 static void syscall_handler (struct intr_frame *);
 static bool is_valid (void *p);
 static int sys_write (int fd, const void *buffer, unsigned size);
@@ -26,10 +32,22 @@ static int sys_exec(const char *cmd_line);
 static int sys_wait(int pid);
 static int sys_read(int fd, const void *buffer, unsigned size);
 
+struct kmem_cache *process_cache;
+
+/* Cache of `struct file_holder's. */
+static struct kmem_cache *file_holder_cache;
+
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
+  futex_init ();
+  process_cache = kmem_cache_create ("process", sizeof (struct process),
+                                     0, NULL);
+  file_holder_cache = kmem_cache_create ("file_holder",
+                                         sizeof (struct file_holder), 0, NULL);
+  if (process_cache == NULL || file_holder_cache == NULL)
+    PANIC ("could not create system call caches");
 }
 
 
@@ -37,17 +55,17 @@ syscall_init (void)
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
-  /* read/write lock for read/write synchronization? */
-  lock_init (&rw_lock);
   uint32_t *p = f->esp;
   bool valid = true;
   int status;
   sema_init(&sys_sema, 1);
   exec_counter = 0;
+  thread_current ()->user_esp = f->esp;
 
   if (!is_valid(p)){
   	sys_exit(-1);
   }
+  TRACE (TRACE_SYSCALL_ENTER, *p, 0);
 
   /* We increment our pointer to take into account the parameters of each function.*/
   switch(*p){	  
@@ -165,11 +183,58 @@ syscall_handler (struct intr_frame *f UNUSED)
 
 	  	break;
 
+	  case SYS_FUTEX_WAIT:
+	  	if (!is_valid(p+1) || !is_valid(p+2)){
+	  		sys_exit(-1);
+	  	}
+
+	  	f->eax = futex_wait((int32_t *) *(p+1), *(p+2));
+
+	  	break;
+
+	  case SYS_FUTEX_WAKE:
+	  	if (!is_valid(p+1) || !is_valid(p+2)){
+	  		sys_exit(-1);
+	  	}
+
+	  	f->eax = futex_wake((int32_t *) *(p+1), *(p+2));
+
+	  	break;
+
+	  case SYS_THREAD_CREATE:
+	  	if (!is_valid(p+1) || !is_valid(p+2) || !is_valid(p+3)){
+	  		sys_exit(-1);
+	  	}
+
+	  	f->eax = process_thread_create((void *) *(p+1), (void *) *(p+2),
+	  	                               (void *) *(p+3));
+
+	  	break;
+
+	  case SYS_THREAD_JOIN:
+	  	if (!is_valid(p+1)){
+	  		sys_exit(-1);
+	  	}
+
+	  	f->eax = process_thread_join(*(p+1));
+
+	  	break;
+
+	  case SYS_THREAD_EXIT:
+	  	if (!is_valid(p+1)){
+	  		sys_exit(-1);
+	  	}
+
+	  	process_thread_exit(*(p+1));
+
+	  	break;
+
 	  default:
 	  	/*I hope to god this never happens.*/
 	  	ASSERT(false) 
 	  	break;
 	}
+  TRACE (TRACE_SYSCALL_EXIT, *p, f->eax);
 }
 
 
@@ -182,6 +247,13 @@ static bool is_valid (void *p){
 		return valid;
 	}
 	void *page = pagedir_get_page((thread_current()->pagedir), p);
+	/* Not touched yet?  Bring it in now. */
+#ifdef VM
+	if (page == NULL && page_load (p))
+		page = pagedir_get_page((thread_current()->pagedir), p);
+#endif
+	if (page == NULL && process_grow_stack (p, thread_current ()->user_esp))
+		page = pagedir_get_page((thread_current()->pagedir), p);
 	if (page == NULL){
 		valid = false;
 		return valid;
@@ -211,13 +283,14 @@ static int sys_write (int fd, const void *buffer, unsigned size){
 	else {
 		bool found = false;
 
-		struct thread *cur = thread_current();
+		struct thread *cur = thread_current()->leader;
 		struct list_elem *e;
 		
 		if (cur->file == NULL)
 			sys_exit(0);
 		
 		/*Traversing through our list of file descriptors.*/
+		lock_acquire(&cur->fd_lock);
 	  	for (e = list_begin (&cur->fd_list); (e != list_end (&cur->fd_list) && !found);
 	    e = list_next (e)){
 	  		struct file_holder *f = list_entry (e, struct file_holder, file_elem);
@@ -229,6 +302,7 @@ static int sys_write (int fd, const void *buffer, unsigned size){
 	  			bytes_written = file_write(f->file, buffer, size);
 	  		}
 		}
+		lock_release(&cur->fd_lock);
 	}
 
 	return bytes_written;
@@ -237,9 +311,35 @@ static int sys_write (int fd, const void *buffer, unsigned size){
 
 /*Terminates current user program, returning status to the kernel.*/
  void sys_exit (int status){
+	/*The process's status is reported on behalf of its main thread.*/
+	struct thread *cur = thread_current()->leader;
+
+	/*A bad buffer can fault us out of the middle of a read or write;
+	  don't take the other threads' file descriptors down with us.*/
+	if(lock_held_by_current_thread(&cur->fd_lock)){
+		lock_release(&cur->fd_lock);
+	}
+
+	/*Only the first thread to exit the process sets its status.  The
+	  main thread reports it once the whole process is torn down, in
+	  process_exit(), so that wait() can't return any earlier.*/
+	if(process_begin_exit()){
+		cur->exit_status = status;
+	}
+	thread_exit();
+}
+
+
+/*Reports the running process's exit status to its parent.  Called by
+  the main thread, last thing in process_exit().*/
+void sys_exit_report (void){
 /*Oh my god this code seriously took forever.*/
 	char *save_ptr;
 	struct thread *cur = thread_current();
+	int status = cur->exit_status;
+
+	ASSERT(cur->leader == cur);
+
 	// printf("Status: %d\n", status);
 	printf ("%s: exit(%d)\n", strtok_r(cur->name, " ", &save_ptr), status);
 	bool found = false;
@@ -265,8 +365,6 @@ static int sys_write (int fd, const void *buffer, unsigned size){
 	
 	/*Gotta wake up from wait.*/
 	sema_up(&cur->parent_thread->sema_alive);
-
-	thread_exit();
 }
 
 
@@ -304,19 +402,26 @@ static int sys_open (const char *file){
 		 return -1;
 	}
 
-	struct thread *cur = thread_current();
+	struct thread *cur = thread_current()->leader;
 	cur->file = file;
 
 	struct file_holder *fh;
-	fh = palloc_get_page(PAL_USER);
+	fh = kmem_cache_alloc(file_holder_cache);
+	if(fh == NULL){
+		file_close(fp);
+		return -1;
+	}
 
-	/*Adding to list of files.*/
+	/*Adding to list of files.  Other threads of the process may be
+	  opening and closing files too.*/
 	fh->file = fp;
+	lock_acquire(&cur->fd_lock);
 	fh->fd = cur->fd_next;
 	cur->fd_next++;
 
 	/*Each process has its own file descriptor list.*/
-	list_push_back(&thread_current()->fd_list, &fh->file_elem);
+	list_push_back(&cur->fd_list, &fh->file_elem);
+	lock_release(&cur->fd_lock);
 
 	return fh->fd;
 }
@@ -331,20 +436,23 @@ static int sys_filesize(int fd){
 
 	bool found = false;
 
-	struct thread *cur = thread_current();
+	struct thread *cur = thread_current()->leader;
 	struct list_elem *e;
+	int length = -1;
 	
+	lock_acquire(&cur->fd_lock);
   	for (e = list_begin (&cur->fd_list); (e != list_end (&cur->fd_list) && !found);
     e = list_next (e)){
   		struct file_holder *f = list_entry (e, struct file_holder, file_elem);
   		
   		if(f->fd == fd){
   			found = true;
-  			return file_length(f->file);
+  			length = file_length(f->file);
   		}
 	}
+	lock_release(&cur->fd_lock);
 
-	return -1;	
+	return length;	
 }
 
 
@@ -358,10 +466,11 @@ static void sys_close(int fd){
 
 	bool found = false;
 
-	struct thread *cur = thread_current();
+	struct thread *cur = thread_current()->leader;
 	struct list_elem *e;
 
 	/*Traversing through the list of file descriptors... as usual.*/
+	lock_acquire(&cur->fd_lock);
   	for (e = list_begin (&cur->fd_list); (e != list_end (&cur->fd_list) && !found);
     e = list_next (e)){
   		struct file_holder *f = list_entry (e, struct file_holder, file_elem);
@@ -370,8 +479,11 @@ static void sys_close(int fd){
   			found = true;
   			file_close(f->file);
   			list_remove(e);
+  			kmem_cache_free(file_holder_cache, f);
+  			break;
   		}
 	}
+	lock_release(&cur->fd_lock);
 
 	/*If not found, then you want to exit, since the fd is invalid.*/
 	if(!found){
@@ -430,10 +542,11 @@ static void sys_seek(int fd, unsigned position){
 
 	bool found = false;
 
-	struct thread *cur = thread_current();
+	struct thread *cur = thread_current()->leader;
 	struct list_elem *e;
 
 	/*Traversing through the list.*/
+	lock_acquire(&cur->fd_lock);
   	for (e = list_begin (&cur->fd_list); (e != list_end (&cur->fd_list) && !found);
     e = list_next (e)){
   		struct file_holder *f = list_entry (e, struct file_holder, file_elem);
@@ -444,6 +557,7 @@ static void sys_seek(int fd, unsigned position){
   			file_seek(f->file, position);
   		}
 	}
+	lock_release(&cur->fd_lock);
 
 	if(!found){
 		sys_exit(-1);
@@ -460,23 +574,24 @@ static unsigned sys_tell(int fd){
 
 	bool found = false;
 
-	struct thread *cur = thread_current();
+	struct thread *cur = thread_current()->leader;
 	struct list_elem *e;
+	unsigned position = -1;
 	
 	/*Traversing through our file descriptors.*/
+	lock_acquire(&cur->fd_lock);
   	for (e = list_begin (&cur->fd_list); (e != list_end (&cur->fd_list) && !found);
     e = list_next (e)){
   		struct file_holder *f = list_entry (e, struct file_holder, file_elem);
   		
   		if(f->fd == fd){
   			found = true;
-  			return file_tell(f->file);
+  			position = file_tell(f->file);
   		}
 	}
+	lock_release(&cur->fd_lock);
 
-	if(!found){
-		return -1;
-	}
+	return position;
 }
 
 /*Reads "size" bytes from the open file as "fd" into the buffer.*/ 
@@ -501,10 +616,11 @@ static int sys_read (int fd, const void *buffer, unsigned size){
 	else {
 		bool found = false;
 
-		struct thread *cur = thread_current();
+		struct thread *cur = thread_current()->leader;
 		struct list_elem *e;
 		
 		/*Traversing the list to find our file.*/
+		lock_acquire(&cur->fd_lock);
 	  	for (e = list_begin (&cur->fd_list); (e != list_end (&cur->fd_list) && !found);
 	    e = list_next (e)){
 	  		struct file_holder *f = list_entry (e, struct file_holder, file_elem);
@@ -514,6 +630,7 @@ static int sys_read (int fd, const void *buffer, unsigned size){
 	  			bytes_read = file_read(f->file, buffer, size);
 	  		}
 		}
+		lock_release(&cur->fd_lock);
 	}
 
 	return bytes_read;
@@ -540,7 +657,7 @@ static int sys_exec(const char *cmd_line){
 	}
 
 	/*Setting attributes for the metadata.*/
-	struct process *p = malloc(sizeof(struct process));
+	struct process *p = kmem_cache_alloc(process_cache);
 	p->alive = true;
 	p->pid = pid;
 	p->exit_status = -23;
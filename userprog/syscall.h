@@ -5,6 +5,7 @@
 
 void syscall_init (void);
 void sys_exit (int status);
+void sys_exit_report (void);
 
 struct semaphore sys_sema;
 int exec_counter;
@@ -18,5 +19,8 @@ struct process
 	bool wait; 
 };
 
+/* Cache of `struct process'es. */
+extern struct kmem_cache *process_cache;
+
 
 #endif /* userprog/syscall.h */
@@ -4,6 +4,7 @@
 #include "userprog/gdt.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
+#include "threads/smp.h"
 #include "threads/vaddr.h"
 
 /* The Task-State Segment (TSS).
@@ -72,35 +73,46 @@ struct tss
     uint16_t trace, bitmap;
   };
 
-/* Kernel TSS. */
-static struct tss *tss;
+/* Each CPU has its own kernel TSS, in its struct cpu, because
+   each needs its own ring 0 stack pointer. */
 
-/* Initializes the kernel TSS. */
+/* Initializes the BSP's kernel TSS. */
 void
 tss_init (void) 
 {
+  tss_init_cpu (&cpus[0]);
+  tss_update ();
+}
+
+/* Initializes the kernel TSS for CPU C. */
+void
+tss_init_cpu (struct cpu *c) 
+{
+  struct tss *tss;
+
   /* Our TSS is never used in a call gate or task gate, so only a
      few fields of it are ever referenced, and those are the only
      ones we initialize. */
   tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
-  tss_update ();
+  c->tss = tss;
 }
 
-/* Returns the kernel TSS. */
+/* Returns the running CPU's kernel TSS. */
 struct tss *
 tss_get (void) 
 {
+  struct tss *tss = cpu_current ()->tss;
   ASSERT (tss != NULL);
   return tss;
 }
 
-/* Sets the ring 0 stack pointer in the TSS to point to the end
-   of the thread stack. */
+/* Sets the ring 0 stack pointer in the running CPU's TSS to
+   point to the end of the thread stack.  Must be called with
+   interrupts off. */
 void
 tss_update (void) 
 {
-  ASSERT (tss != NULL);
-  tss->esp0 = (uint8_t *) thread_current () + PGSIZE;
+  tss_get ()->esp0 = (uint8_t *) thread_current () + PGSIZE;
 }
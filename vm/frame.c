@@ -0,0 +1,330 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/* Frame table.
+
+   Every page of the user pool that holds a page from some
+   process's supplemental page table has a frame here, which says
+   whose page it is.  When the user pool runs dry, frame_alloc()
+   takes a frame away from its page with the "second chance"
+   clock algorithm: the hand sweeps the frames in the order they
+   were allocated, clearing the accessed bit of each page it
+   passes, and stops at the first page that has not been
+   accessed since the last sweep.
+
+   A page that goes to swap may take some of its neighbors along
+   (see page_evict()).  Their frames go back to the user pool, so
+   that the next few allocations find a free page.
+
+   Evicting a page changes its process's supplemental page
+   table, so the hand skips pages whose process's table is locked
+   by another thread rather than wait for it.  A thread that is
+   filling a page holds that lock, so such a page is never taken
+   away half-loaded.
+
+   Pages are chosen and unmapped under frame_lock, but written to
+   swap without it, so that other threads can allocate frames
+   while the disk is busy.  The frames being written stay in the
+   table, marked busy so that the hand passes them by, until the
+   write is done.
+
+   A page can also be pinned with frame_pin(), which keeps the
+   hand from taking it at all.  futex.c pins each futex word that
+   has sleepers, because it finds their wait queue by the word's
+   physical address. */
+
+/* A frame. */
+struct frame
+  {
+    struct hash_elem elem;      /* Element in `frames'. */
+    struct list_elem clock_elem; /* Element in `clock_list'. */
+    void *kpage;                /* Kernel virtual address. */
+    void *upage;                /* User virtual address. */
+    struct thread *owner;       /* Main thread of owning process. */
+    bool busy;                  /* Being written out by evict()? */
+    unsigned pin_cnt;           /* Number of frame_pin() calls in force. */
+  };
+
+/* Frames, by kernel address and in clock order.  The clock hand
+   points into `clock_list', or to its end if the list is empty.
+   All protected by frame_lock. */
+static struct hash frames;
+static struct list clock_list;
+static struct list_elem *clock_hand;
+static struct lock frame_lock;
+
+/* Cache of `struct frame's. */
+static struct kmem_cache *frame_cache;
+
+static struct frame *frame_lookup (void *kpage);
+static void frame_remove (struct frame *);
+static void *alloc (enum palloc_flags, void *upage, bool may_evict);
+static void *evict (void);
+static hash_hash_func frame_hash;
+static hash_less_func frame_less;
+
+/* Initializes the frame table. */
+void
+frame_init (void) 
+{
+  frame_cache = kmem_cache_create ("frame", sizeof (struct frame), 0, NULL);
+  if (frame_cache == NULL || !hash_init (&frames, frame_hash, frame_less, NULL))
+    PANIC ("could not create frame table");
+  list_init (&clock_list);
+  clock_hand = list_end (&clock_list);
+  lock_init (&frame_lock);
+}
+
+/* Obtains a page from the user pool for user page UPAGE in the
+   running process, evicting some other page if the pool is
+   empty, and returns its kernel virtual address.  If FLAGS
+   includes PAL_ZERO, the page is zeroed.  Returns a null pointer
+   if no page can be had.
+
+   The caller must hold the running process's pages_lock until
+   the page is mapped, and must give the page back with
+   frame_free(), not palloc_free_page(). */
+void *
+frame_alloc (enum palloc_flags flags, void *upage) 
+{
+  return alloc (flags, upage, true);
+}
+
+/* Like frame_alloc(), but returns a null pointer rather than
+   evict a page, and does not zero the page. */
+void *
+frame_try_alloc (void *upage) 
+{
+  return alloc (0, upage, false);
+}
+
+/* Removes KPAGE, obtained from frame_alloc(), from the frame
+   table and frees it.  KPAGE must no longer be mapped. */
+void
+frame_free (void *kpage) 
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = frame_lookup (kpage);
+  ASSERT (f != NULL && !f->busy);
+  frame_remove (f);
+  lock_release (&frame_lock);
+
+  kmem_cache_free (frame_cache, f);
+  palloc_free_page (kpage);
+}
+
+/* Keeps the page that contains user address UADDR in the
+   running process from being evicted, and returns UADDR's kernel
+   virtual address.  Returns a null pointer, pinning nothing, if
+   the page is not in memory.  Undo with frame_unpin(). */
+void *
+frame_pin (const void *uaddr) 
+{
+  struct frame *f;
+  void *kaddr;
+
+  lock_acquire (&frame_lock);
+  kaddr = pagedir_get_page (thread_current ()->leader->pagedir, uaddr);
+  if (kaddr != NULL) 
+    {
+      f = frame_lookup (pg_round_down (kaddr));
+      if (f != NULL)
+        f->pin_cnt++;
+    }
+  lock_release (&frame_lock);
+  return kaddr;
+}
+
+/* Undoes a frame_pin() call that returned KADDR.  Does nothing if
+   the page has been freed since. */
+void
+frame_unpin (void *kaddr) 
+{
+  struct frame *f;
+
+  lock_acquire (&frame_lock);
+  f = frame_lookup (pg_round_down (kaddr));
+  if (f != NULL && f->pin_cnt > 0)
+    f->pin_cnt--;
+  lock_release (&frame_lock);
+}
+
+/* Returns true if KPAGE, obtained from frame_alloc(), is pinned.
+   frame_lock must be held, as it is during page_evict(). */
+bool
+frame_is_pinned (void *kpage) 
+{
+  struct frame *f;
+
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  f = frame_lookup (kpage);
+  return f != NULL && f->pin_cnt > 0;
+}
+
+/* Does the work of frame_alloc() and frame_try_alloc(), evicting
+   a page if the pool is empty only if MAY_EVICT is true. */
+static void *
+alloc (enum palloc_flags flags, void *upage, bool may_evict) 
+{
+  struct thread *leader = thread_current ()->leader;
+  struct frame *f;
+  void *kpage;
+
+  ASSERT (lock_held_by_current_thread (&leader->pages_lock));
+
+  f = kmem_cache_alloc (frame_cache);
+  if (f == NULL)
+    return NULL;
+
+  lock_acquire (&frame_lock);
+  kpage = palloc_get_page (PAL_USER | flags);
+  if (kpage == NULL && may_evict) 
+    {
+      kpage = evict ();
+      if (kpage != NULL && (flags & PAL_ZERO))
+        memset (kpage, 0, PGSIZE);
+    }
+  if (kpage != NULL) 
+    {
+      f->kpage = kpage;
+      f->upage = upage;
+      f->owner = leader;
+      f->busy = false;
+      f->pin_cnt = 0;
+      hash_insert (&frames, &f->elem);
+      list_insert (clock_hand, &f->clock_elem);
+    }
+  lock_release (&frame_lock);
+
+  if (kpage == NULL)
+    kmem_cache_free (frame_cache, f);
+  return kpage;
+}
+
+/* Returns the frame for KPAGE, or a null pointer if there is
+   none.  frame_lock must be held. */
+static struct frame *
+frame_lookup (void *kpage) 
+{
+  struct frame key;
+  struct hash_elem *e;
+
+  key.kpage = kpage;
+  e = hash_find (&frames, &key.elem);
+  return e != NULL ? hash_entry (e, struct frame, elem) : NULL;
+}
+
+/* Removes F from the frame table, moving the clock hand past it
+   if need be.  frame_lock must be held. */
+static void
+frame_remove (struct frame *f) 
+{
+  if (clock_hand == &f->clock_elem)
+    clock_hand = list_next (clock_hand);
+  list_remove (&f->clock_elem);
+  hash_delete (&frames, &f->elem);
+}
+
+/* Chooses a page to evict with the clock algorithm, writes it
+   out if need be, and returns its now free kernel page.  Returns
+   a null pointer if no page could be evicted.  frame_lock must
+   be held; it is released while the page is written. */
+static void *
+evict (void) 
+{
+  /* Two full sweeps: one to clear accessed bits, one more to
+     find a page whose bit stayed clear. */
+  size_t tries = 2 * list_size (&clock_list);
+
+  while (tries-- > 0) 
+    {
+      void *kpages[SWAP_CLUSTER];
+      struct frame *f;
+      struct thread *owner;
+      size_t cnt, slot, i;
+      bool own;
+
+      if (clock_hand == list_end (&clock_list))
+        clock_hand = list_begin (&clock_list);
+      f = list_entry (clock_hand, struct frame, clock_elem);
+      clock_hand = list_next (clock_hand);
+      if (f->busy || f->pin_cnt > 0)
+        continue;
+
+      owner = f->owner;
+      own = lock_held_by_current_thread (&owner->pages_lock);
+      if (!own && !lock_try_acquire (&owner->pages_lock))
+        continue;
+
+      if (pagedir_is_accessed (owner->pagedir, f->upage)) 
+        {
+          pagedir_set_accessed (owner->pagedir, f->upage, false);
+          cnt = 0;
+        }
+      else
+        cnt = page_evict (owner, f->upage, kpages, SWAP_CLUSTER, &slot);
+
+      if (cnt > 0 && slot != SWAP_ERROR) 
+        {
+          /* The pages are unmapped, so only we can touch them
+             now, and the owner's pages_lock keeps anyone from
+             looking for them in swap before they get there. */
+          for (i = 0; i < cnt; i++)
+            frame_lookup (kpages[i])->busy = true;
+          lock_release (&frame_lock);
+          swap_write (slot, kpages, cnt);
+          lock_acquire (&frame_lock);
+        }
+      if (!own)
+        lock_release (&owner->pages_lock);
+
+      if (cnt > 0) 
+        {
+          /* Keep the first page for our caller and give the rest
+             of the cluster back to the pool, so that the next
+             few allocations need not evict. */
+          for (i = 0; i < cnt; i++) 
+            {
+              struct frame *g = frame_lookup (kpages[i]);
+              frame_remove (g);
+              kmem_cache_free (frame_cache, g);
+              if (i > 0)
+                palloc_free_page (kpages[i]);
+            }
+          return kpages[0];
+        }
+    }
+  return NULL;
+}
+
+/* Returns a hash value for frame E. */
+static unsigned
+frame_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct frame *f = hash_entry (e, struct frame, elem);
+  return hash_int ((uintptr_t) f->kpage >> PGBITS);
+}
+
+/* Returns true if frame A precedes frame B. */
+static bool
+frame_less (const struct hash_elem *a_, const struct hash_elem *b_,
+            void *aux UNUSED) 
+{
+  const struct frame *a = hash_entry (a_, struct frame, elem);
+  const struct frame *b = hash_entry (b_, struct frame, elem);
+
+  return a->kpage < b->kpage;
+}
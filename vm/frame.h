@@ -0,0 +1,15 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <stdbool.h>
+#include "threads/palloc.h"
+
+void frame_init (void);
+void *frame_alloc (enum palloc_flags, void *upage);
+void *frame_try_alloc (void *upage);
+void frame_free (void *kpage);
+void *frame_pin (const void *uaddr);
+void frame_unpin (void *kaddr);
+bool frame_is_pinned (void *kpage);
+
+#endif /* vm/frame.h */
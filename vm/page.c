@@ -0,0 +1,496 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Supplemental page table.
+
+   load() no longer reads an executable into memory.  Instead it
+   records, for each page of each segment, where the page's
+   contents come from, in a hash table kept in the process's
+   main thread and shared by all of its threads.  The first
+   access to a page faults, and page_fault() calls page_load() to
+   allocate a frame, fill it and map it.  So a process only
+   spends memory and disk reads on the pages it touches.
+
+   When memory runs short, the frame table (see frame.c) calls
+   page_evict() to unmap a page.  A page that has not been
+   modified since it was loaded is simply dropped, because it can
+   be loaded again from where it came from.  Any other page goes
+   to swap and becomes PAGE_SWAP.
+
+   Swap traffic is clustered.  A page going to swap takes along
+   neighboring pages that would go to swap anyway and have not
+   been used lately, and they are written to consecutive slots
+   in address order with a single request.  Faulting any of them
+   back in then reads as many of the rest as there are free
+   frames for, again with one request.
+
+   A process's table is protected by its main thread's
+   pages_lock, which is held from the time a page is looked up
+   until it is mapped or unmapped.  Threads that hold one may
+   acquire frame.c's frame_lock, but not the other way around. */
+
+/* Stack limit given to each new process, in bytes. */
+size_t user_stack_limit = MAIN_STACK_SIZE;
+
+/* Cache of `struct page's. */
+static struct kmem_cache *page_cache;
+
+static hash_hash_func page_hash;
+static hash_less_func page_less;
+static hash_action_func page_free;
+static struct page *page_lookup (struct thread *leader, const void *upage);
+static bool page_add (struct page *);
+static bool cluster_candidate (struct thread *leader, const void *upage);
+static bool load_swapped (struct thread *leader, struct page *);
+static struct page *cluster_neighbor (struct thread *leader,
+                                      const struct page *, int delta);
+
+/* Initializes the supplemental page table module. */
+void
+page_init (void) 
+{
+  page_cache = kmem_cache_create ("page", sizeof (struct page), 0, NULL);
+  if (page_cache == NULL)
+    PANIC ("could not create page cache");
+  frame_init ();
+}
+
+/* Initializes the running thread's supplemental page table.
+   Returns true if successful, false if memory is short. */
+bool
+page_table_init (void) 
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->leader == t);
+
+  lock_init (&t->pages_lock);
+  t->stack_limit = user_stack_limit;
+  return hash_init (&t->pages, page_hash, page_less, NULL);
+}
+
+/* Destroys the running thread's supplemental page table,
+   freeing its pages' frames and swap slots.  The page directory
+   must still be in place. */
+void
+page_table_destroy (void) 
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->leader == t);
+
+  lock_acquire (&t->pages_lock);
+  hash_destroy (&t->pages, page_free);
+  lock_release (&t->pages_lock);
+}
+
+/* Records that user page UPAGE in the running process is to be
+   loaded from READ_BYTES bytes at offset OFS in FILE, followed by
+   PGSIZE - READ_BYTES zero bytes.  If WRITABLE is true, the
+   process may modify the page; otherwise, it is read-only.
+   Returns true if successful, false if UPAGE is already in use
+   or memory is short. */
+bool
+page_add_file (void *upage, struct file *file, off_t ofs,
+               uint32_t read_bytes, bool writable) 
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = kmem_cache_alloc (page_cache);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->type = PAGE_FILE;
+  p->writable = writable;
+  p->file = file;
+  p->ofs = ofs;
+  p->read_bytes = read_bytes;
+  return page_add (p);
+}
+
+/* Records that user page UPAGE in the running process is to be
+   filled with zeros.  If WRITABLE is true, the process may
+   modify the page; otherwise, it is read-only.  Returns true if
+   successful, false if UPAGE is already in use or memory is
+   short. */
+bool
+page_add_zero (void *upage, bool writable) 
+{
+  struct page *p = kmem_cache_alloc (page_cache);
+  if (p == NULL)
+    return false;
+  p->upage = upage;
+  p->type = PAGE_ZERO;
+  p->writable = writable;
+  p->file = NULL;
+  return page_add (p);
+}
+
+/* Brings the page containing user virtual address ADDR in the
+   running process into memory and maps it, if it is in the
+   supplemental page table.  Returns true if the page is now
+   mapped, false if ADDR is not in the table or memory is
+   short. */
+bool
+page_load (const void *addr) 
+{
+  struct thread *leader = thread_current ()->leader;
+  void *upage = pg_round_down (addr);
+  uint32_t *pd = leader->pagedir;
+  struct page *p;
+  uint8_t *kpage;
+  bool success = false;
+
+  if (pd == NULL || !is_user_vaddr (addr))
+    return false;
+
+  lock_acquire (&leader->pages_lock);
+  p = page_lookup (leader, upage);
+  if (p == NULL)
+    goto done;
+
+  /* Another thread may have loaded it while we waited. */
+  if (pagedir_get_page (pd, upage) != NULL) 
+    {
+      success = true;
+      goto done;
+    }
+
+  if (p->type == PAGE_SWAP) 
+    {
+      success = load_swapped (leader, p);
+      goto done;
+    }
+
+  kpage = frame_alloc (p->type == PAGE_ZERO ? PAL_ZERO : 0, upage);
+  if (kpage == NULL)
+    goto done;
+
+  if (p->type == PAGE_FILE) 
+    {
+      if (file_read_at (p->file, kpage, p->read_bytes, p->ofs)
+          != (off_t) p->read_bytes) 
+        {
+          frame_free (kpage);
+          goto done;
+        }
+      memset (kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+    }
+
+  if (!pagedir_set_page (pd, upage, kpage, p->writable)) 
+    {
+      frame_free (kpage);
+      goto done;
+    }
+  success = true;
+
+ done:
+  lock_release (&leader->pages_lock);
+  return success;
+}
+
+/* Removes UPAGE from the running process's supplemental page
+   table, if it is there, freeing its frame or swap slot. */
+void
+page_remove (void *upage) 
+{
+  struct thread *leader = thread_current ()->leader;
+  struct page *p;
+
+  lock_acquire (&leader->pages_lock);
+  p = page_lookup (leader, upage);
+  if (p != NULL) 
+    {
+      hash_delete (&leader->pages, &p->elem);
+      page_free (&p->elem, NULL);
+    }
+  lock_release (&leader->pages_lock);
+}
+
+/* Unmaps UPAGE, which must be in memory, in the process whose
+   main thread is LEADER, so that its frame can be reused.  If
+   the page must go to swap, up to MAX - 1 neighboring pages that
+   would also go to swap and have not been accessed lately are
+   unmapped along with it, consecutive swap slots are reserved
+   for them, and they all become PAGE_SWAP.  Stores the kernel
+   addresses of the pages unmapped into KPAGES and returns how
+   many there are, or returns 0 if swap is full.
+
+   Does not write anything, so that the caller can do the I/O
+   without holding frame_lock.  If *SLOT is set to other than
+   SWAP_ERROR, the caller must swap_write() the returned pages
+   starting at *SLOT before releasing LEADER's pages_lock.
+   LEADER's pages_lock and frame.c's frame_lock must be held. */
+size_t
+page_evict (struct thread *leader, void *upage, void *kpages[], size_t max,
+            size_t *slot) 
+{
+  uint32_t *pd = leader->pagedir;
+  struct page *p = page_lookup (leader, upage);
+  struct page *run[SWAP_CLUSTER];
+  size_t below, above, cnt, i;
+  uint8_t *first;
+
+  ASSERT (lock_held_by_current_thread (&leader->pages_lock));
+  ASSERT (p != NULL);
+  ASSERT (max > 0 && max <= SWAP_CLUSTER);
+
+  /* Unmap first, so that the dirty bit we check below is final:
+     other threads of the process can no longer write the page,
+     and any access will fault and wait for pages_lock. */
+  kpages[0] = pagedir_get_page (pd, upage);
+  ASSERT (kpages[0] != NULL);
+  pagedir_clear_page (pd, upage);
+  *slot = SWAP_ERROR;
+  if (p->type != PAGE_SWAP && !pagedir_is_dirty (pd, upage))
+    return 1;
+
+  /* Gather the cluster and reserve slots for it, falling back to
+     the page alone if swap is too fragmented. */
+  for (above = 0; 1 + above < max; above++)
+    if (!cluster_candidate (leader, (uint8_t *) upage + (above + 1) * PGSIZE))
+      break;
+  for (below = 0; 1 + above + below < max; below++)
+    if (!cluster_candidate (leader, (uint8_t *) upage - (below + 1) * PGSIZE))
+      break;
+  cnt = below + 1 + above;
+  *slot = swap_alloc (cnt);
+  if (*slot == SWAP_ERROR && cnt > 1) 
+    {
+      below = above = 0;
+      cnt = 1;
+      *slot = swap_alloc (1);
+    }
+  if (*slot == SWAP_ERROR) 
+    {
+      /* Put it back as it was.  Its page table exists, so this
+         cannot fail. */
+      pagedir_set_page (pd, upage, kpages[0], p->writable);
+      pagedir_set_dirty (pd, upage, true);
+      return 0;
+    }
+
+  /* Unmap the rest, in address order to match the slots. */
+  first = (uint8_t *) upage - below * PGSIZE;
+  kpages[below] = kpages[0];
+  for (i = 0; i < cnt; i++) 
+    {
+      void *u = first + i * PGSIZE;
+
+      run[i] = page_lookup (leader, u);
+      if (i != below) 
+        {
+          kpages[i] = pagedir_get_page (pd, u);
+          pagedir_clear_page (pd, u);
+        }
+    }
+
+  /* Nothing can see these entries before the caller has written
+     the pages, because it keeps pages_lock until then. */
+  for (i = 0; i < cnt; i++) 
+    {
+      run[i]->type = PAGE_SWAP;
+      run[i]->swap_slot = *slot + i;
+    }
+  return cnt;
+}
+
+/* Returns true if UPAGE in the process whose main thread is
+   LEADER is in memory, is not pinned, has not been accessed
+   lately, and would have to go to swap if evicted.  LEADER's
+   pages_lock and frame.c's frame_lock must be held. */
+static bool
+cluster_candidate (struct thread *leader, const void *upage) 
+{
+  uint32_t *pd = leader->pagedir;
+  struct page *p;
+  void *kpage;
+
+  if (!is_user_vaddr (upage))
+    return false;
+  p = page_lookup (leader, upage);
+  kpage = pagedir_get_page (pd, upage);
+  return (p != NULL
+          && kpage != NULL
+          && !frame_is_pinned (kpage)
+          && !pagedir_is_accessed (pd, upage)
+          && (p->type == PAGE_SWAP || pagedir_is_dirty (pd, upage)));
+}
+
+/* Reads swapped-out page P of the process whose main thread is
+   LEADER back in and maps it.  The neighboring pages that went
+   out in the same cluster, which follow P's virtual address and
+   slot in step, are read with it in one request and mapped too,
+   as far as there are free frames for them: evicting pages to
+   make room for pages that may never be touched would defeat
+   the purpose.  Returns true if P is now mapped.  LEADER's
+   pages_lock must be held. */
+static bool
+load_swapped (struct thread *leader, struct page *p) 
+{
+  uint32_t *pd = leader->pagedir;
+  struct page *up[SWAP_CLUSTER], *down[SWAP_CLUSTER];
+  void *up_kpages[SWAP_CLUSTER], *down_kpages[SWAP_CLUSTER];
+  struct page *run[SWAP_CLUSTER];
+  void *kpages[SWAP_CLUSTER];
+  size_t below, above, cnt, i;
+  bool success = false;
+  void *kpage;
+
+  /* P's own frame comes first, because getting it may evict
+     other pages of this process, which must all be mapped. */
+  kpage = frame_alloc (0, p->upage);
+  if (kpage == NULL)
+    return false;
+
+  for (above = 0; 1 + above < SWAP_CLUSTER; above++) 
+    {
+      up[above] = cluster_neighbor (leader, p, (int) above + 1);
+      if (up[above] == NULL)
+        break;
+      up_kpages[above] = frame_try_alloc (up[above]->upage);
+      if (up_kpages[above] == NULL)
+        break;
+    }
+  for (below = 0; 1 + above + below < SWAP_CLUSTER; below++) 
+    {
+      down[below] = cluster_neighbor (leader, p, -(int) below - 1);
+      if (down[below] == NULL)
+        break;
+      down_kpages[below] = frame_try_alloc (down[below]->upage);
+      if (down_kpages[below] == NULL)
+        break;
+    }
+
+  /* Lay the cluster out in address order. */
+  cnt = 0;
+  for (i = below; i-- > 0; cnt++) 
+    {
+      run[cnt] = down[i];
+      kpages[cnt] = down_kpages[i];
+    }
+  run[cnt] = p;
+  kpages[cnt++] = kpage;
+  for (i = 0; i < above; i++, cnt++) 
+    {
+      run[cnt] = up[i];
+      kpages[cnt] = up_kpages[i];
+    }
+
+  swap_read (p->swap_slot - below, kpages, cnt);
+  for (i = 0; i < cnt; i++) 
+    if (pagedir_set_page (pd, run[i]->upage, kpages[i], run[i]->writable)) 
+      {
+        swap_free (run[i]->swap_slot);
+        if (run[i] == p)
+          success = true;
+      }
+    else
+      frame_free (kpages[i]);
+  return success;
+}
+
+/* Returns the page DELTA pages away from swapped-out page P in
+   the process whose main thread is LEADER, if it is swapped out
+   too, DELTA slots away from P.  Otherwise, returns a null
+   pointer.  LEADER's pages_lock must be held. */
+static struct page *
+cluster_neighbor (struct thread *leader, const struct page *p, int delta) 
+{
+  const uint8_t *upage = (const uint8_t *) p->upage + delta * PGSIZE;
+  struct page *q;
+
+  if (!is_user_vaddr (upage))
+    return NULL;
+  q = page_lookup (leader, upage);
+  return (q != NULL
+          && q->type == PAGE_SWAP
+          && q->swap_slot == p->swap_slot + delta
+          && pagedir_get_page (leader->pagedir, upage) == NULL
+          ? q : NULL);
+}
+
+/* Adds P to the running process's supplemental page table.
+   Returns true if successful, false (freeing P) if its page is
+   already there. */
+static bool
+page_add (struct page *p) 
+{
+  struct thread *leader = thread_current ()->leader;
+  bool success;
+
+  ASSERT (pg_ofs (p->upage) == 0);
+
+  lock_acquire (&leader->pages_lock);
+  success = hash_insert (&leader->pages, &p->elem) == NULL;
+  lock_release (&leader->pages_lock);
+
+  if (!success)
+    kmem_cache_free (page_cache, p);
+  return success;
+}
+
+/* Returns the page for UPAGE in LEADER's supplemental page
+   table, or a null pointer if there is none.  LEADER's
+   pages_lock must be held. */
+static struct page *
+page_lookup (struct thread *leader, const void *upage) 
+{
+  struct page key;
+  struct hash_elem *e;
+
+  key.upage = (void *) upage;
+  e = hash_find (&leader->pages, &key.elem);
+  return e != NULL ? hash_entry (e, struct page, elem) : NULL;
+}
+
+/* Returns a hash value for page E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED) 
+{
+  const struct page *p = hash_entry (e, struct page, elem);
+  return hash_int ((uintptr_t) p->upage >> PGBITS);
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+           void *aux UNUSED) 
+{
+  const struct page *a = hash_entry (a_, struct page, elem);
+  const struct page *b = hash_entry (b_, struct page, elem);
+
+  return a->upage < b->upage;
+}
+
+/* Frees page E, for hash_destroy(), along with its frame or
+   swap slot.  Runs in a thread of the page's process. */
+static void
+page_free (struct hash_elem *e, void *aux UNUSED) 
+{
+  struct page *p = hash_entry (e, struct page, elem);
+  uint32_t *pd = thread_current ()->pagedir;
+  void *kpage = pagedir_get_page (pd, p->upage);
+
+  if (kpage != NULL) 
+    {
+      pagedir_clear_page (pd, p->upage);
+      frame_free (kpage);
+    }
+  else if (p->type == PAGE_SWAP)
+    swap_free (p->swap_slot);
+  kmem_cache_free (page_cache, p);
+}
@@ -0,0 +1,55 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct thread;
+
+/* Where the contents of a user page come from when it is next
+   brought into memory.  A page that is evicted after it was
+   modified becomes PAGE_SWAP. */
+enum page_type
+  {
+    PAGE_FILE,                  /* Read from a file, zero the rest. */
+    PAGE_ZERO,                  /* All zeros. */
+    PAGE_SWAP                   /* Read from swap. */
+  };
+
+/* A user page in the supplemental page table.  The page table
+   proper says where a page is once it is in memory; this says
+   how to bring it there. */
+struct page
+  {
+    struct hash_elem elem;      /* Element in process's page table. */
+    void *upage;                /* User virtual address. */
+    enum page_type type;        /* Source of the page's contents. */
+    bool writable;              /* May the process write it? */
+
+    /* PAGE_FILE only. */
+    struct file *file;          /* File to read. */
+    off_t ofs;                  /* Offset in FILE. */
+    uint32_t read_bytes;        /* Bytes to read; the rest is zeroed. */
+
+    /* PAGE_SWAP only, while not in memory. */
+    size_t swap_slot;           /* Slot holding the contents. */
+  };
+
+extern size_t user_stack_limit;
+
+void page_init (void);
+bool page_table_init (void);
+void page_table_destroy (void);
+bool page_add_file (void *upage, struct file *, off_t ofs,
+                    uint32_t read_bytes, bool writable);
+bool page_add_zero (void *upage, bool writable);
+bool page_load (const void *addr);
+void page_remove (void *upage);
+size_t page_evict (struct thread *leader, void *upage,
+                   void *kpages[], size_t max, size_t *slot);
+
+#endif /* vm/page.h */
@@ -0,0 +1,148 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Swap space.
+
+   The swap block device is divided into page-sized slots, each
+   PAGE_SECTORS sectors long.  A bitmap records which slots hold
+   an evicted page.  A slot belongs to the page that was written
+   to it until that page is mapped again or its process exits.
+
+   Pages are written and read in clusters of up to SWAP_CLUSTER
+   consecutive slots, each cluster as a single block request, so
+   that a burst of evictions or faults costs one disk command and
+   one seek rather than one per page.  The pages of a cluster are
+   scattered in memory, so they pass through a bounce buffer. */
+
+/* Number of sectors in a page. */
+#define PAGE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Swap device, or a null pointer if there is none. */
+static struct block *swap_device;
+
+/* Slots in use.  Protected by swap_lock. */
+static struct bitmap *swap_map;
+static struct lock swap_lock;
+
+/* SWAP_CLUSTER pages for transfers of more than one page.
+   Protected by buffer_lock. */
+static uint8_t *buffer;
+static struct lock buffer_lock;
+
+/* Statistics.  Protected by buffer_lock. */
+static unsigned long long page_out_cnt; /* Pages written. */
+static unsigned long long write_cnt;    /* Write requests. */
+static unsigned long long page_in_cnt;  /* Pages read. */
+static unsigned long long read_cnt;     /* Read requests. */
+
+/* Initializes swap space.  Without a swap device, swap_alloc()
+   always fails, so pages that would need it are not evicted. */
+void
+swap_init (void) 
+{
+  lock_init (&swap_lock);
+  lock_init (&buffer_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device == NULL)
+    return;
+
+  swap_map = bitmap_create (block_size (swap_device) / PAGE_SECTORS);
+  buffer = palloc_get_multiple (0, SWAP_CLUSTER);
+  if (swap_map == NULL || buffer == NULL)
+    PANIC ("could not allocate swap map");
+}
+
+/* Reserves CNT consecutive free slots and returns the first, or
+   returns SWAP_ERROR if there is no such run. */
+size_t
+swap_alloc (size_t cnt) 
+{
+  size_t slot;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+  if (swap_device == NULL)
+    return SWAP_ERROR;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_map, 0, cnt, false);
+  lock_release (&swap_lock);
+  return slot != BITMAP_ERROR ? slot : SWAP_ERROR;
+}
+
+/* Writes the CNT pages in KPAGES to the slots starting at SLOT,
+   which must have been reserved with swap_alloc(). */
+void
+swap_write (size_t slot, void *const kpages[], size_t cnt) 
+{
+  block_sector_t sector = slot * PAGE_SECTORS;
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+  lock_acquire (&buffer_lock);
+  if (cnt == 1)
+    block_write_multiple (swap_device, sector, PAGE_SECTORS, kpages[0]);
+  else 
+    {
+      for (i = 0; i < cnt; i++)
+        memcpy (buffer + i * PGSIZE, kpages[i], PGSIZE);
+      block_write_multiple (swap_device, sector, cnt * PAGE_SECTORS, buffer);
+    }
+  page_out_cnt += cnt;
+  write_cnt++;
+  lock_release (&buffer_lock);
+}
+
+/* Reads the CNT pages in the slots starting at SLOT into KPAGES.
+   The slots stay in use until swap_free() is called for each. */
+void
+swap_read (size_t slot, void *const kpages[], size_t cnt) 
+{
+  block_sector_t sector = slot * PAGE_SECTORS;
+  size_t i;
+
+  ASSERT (swap_device != NULL);
+  ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+  lock_acquire (&buffer_lock);
+  if (cnt == 1)
+    block_read_multiple (swap_device, sector, PAGE_SECTORS, kpages[0]);
+  else 
+    {
+      block_read_multiple (swap_device, sector, cnt * PAGE_SECTORS, buffer);
+      for (i = 0; i < cnt; i++)
+        memcpy (kpages[i], buffer + i * PGSIZE, PGSIZE);
+    }
+  page_in_cnt += cnt;
+  read_cnt++;
+  lock_release (&buffer_lock);
+}
+
+/* Frees SLOT. */
+void
+swap_free (size_t slot) 
+{
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_map, slot));
+  bitmap_reset (swap_map, slot);
+  lock_release (&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void) 
+{
+  if (swap_device == NULL)
+    return;
+  printf ("Swap: %llu pages out in %llu writes, "
+          "%llu pages in in %llu reads\n",
+          page_out_cnt, write_cnt, page_in_cnt, read_cnt);
+}
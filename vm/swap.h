@@ -0,0 +1,20 @@
+#ifndef VM_SWAP_H
+#define VM_SWAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Returned by swap_alloc() when no run of slots is free. */
+#define SWAP_ERROR SIZE_MAX
+
+/* Most pages swap_read() and swap_write() transfer at once. */
+#define SWAP_CLUSTER 8
+
+void swap_init (void);
+size_t swap_alloc (size_t cnt);
+void swap_write (size_t slot, void *const kpages[], size_t cnt);
+void swap_read (size_t slot, void *const kpages[], size_t cnt);
+void swap_free (size_t slot);
+void swap_print_stats (void);
+
+#endif /* vm/swap.h */